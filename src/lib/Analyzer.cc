@@ -9,6 +9,8 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Support/ManagedStatic.h"
@@ -20,8 +22,13 @@
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/JSON.h"
 
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <vector>
 #include <sstream>
 #include <sys/resource.h>
@@ -29,6 +36,8 @@
 
 #include "Analyzer.h"
 #include "CallGraph.h"
+#include "CallGraphFile.h"
+#include "Server.h"
 #include "Config.h"
 
 using namespace llvm;
@@ -41,52 +50,319 @@ cl::opt<unsigned> VerboseLevel(
     "verbose-level", cl::desc("Print information at which verbose level"),
     cl::init(0));
 
+cl::opt<LogLevel> LogLevelOpt(
+    "log-level", cl::desc("Log messages up to this level"),
+    cl::values(
+      clEnumValN(LL_Error, "error", "Errors only"),
+      clEnumValN(LL_Warn, "warn", "Errors and warnings"),
+      clEnumValN(LL_Info, "info", "Phases, progress and results"),
+      clEnumValN(LL_Verbose, "verbose", "Also every module and iteration"),
+      clEnumValN(LL_Debug, "debug", "Also debugging details, if built \
+        with KA_MAX_LOG_LEVEL=LL_Debug")),
+    cl::init(LL_Info));
+
+cl::opt<unsigned> ProgressInterval(
+    "progress-interval", cl::desc("Milliseconds between progress reports \
+    of a phase"),
+    cl::init(1000));
+
+cl::opt<bool> TimeTrace(
+    "time-trace", cl::desc("Write a trace of the phases of the run, per \
+    thread and module, to -time-trace-file in the Chrome trace-event \
+    format"),
+    cl::init(false));
+
+cl::opt<std::string> TimeTraceFile(
+    "time-trace-file", cl::desc("The file of -time-trace"),
+    cl::init("kanalyzer.time-trace.json"));
+
+cl::opt<unsigned> TimeTraceGranularity(
+    "time-trace-granularity", cl::desc("Minimum microseconds of the \
+    events of -time-trace"),
+    cl::init(500));
+
+cl::opt<bool> TimeSummary(
+    "time-summary", cl::desc("Print the total time of each phase of the \
+    run"),
+    cl::init(false));
+
 cl::opt<int> MLTA(
     "mlta",
   cl::desc("Multi-layer type analysis for refining indirect-call \
     targets"),
   cl::NotHidden, cl::init(2));
 
+cl::opt<unsigned> NumThreads(
+    "j", cl::desc("Number of threads used to load and analyze modules \
+    (0 uses all hardware threads)"),
+    cl::init(1));
+
+cl::opt<unsigned> LayerWalkBudget(
+    "layer-walk-budget", cl::desc("Maximum number of values visited \
+    to find the next-layer type of a value; beyond it, the value is \
+    taken as having no next layer"),
+    cl::init(100000));
+
+cl::opt<bool> BoundedMemory(
+    "bounded-memory", cl::desc("Keep only a few modules in memory at a \
+    time: the type analyses are summarized per module, and call sites \
+    are resolved a window of modules at a time"),
+    cl::init(false));
+
+cl::opt<std::string> SummaryCacheDir(
+    "summary-cache", cl::desc("Directory caching the summaries of \
+    modules by the content of their bitcode files (with -bounded-memory)"),
+    cl::init(""));
+
+cl::opt<std::string> CallgraphBinary(
+    "callgraph-bin", cl::desc("Also write the call graph to this file in \
+    the binary format read by CallGraphFile"),
+    cl::init(""));
+
+cl::opt<std::string> ServeSocket(
+    "serve", cl::desc("After the analysis, keep the results in memory and \
+    answer queries on this Unix domain socket"),
+    cl::init(""));
+
+cl::opt<bool> Incremental(
+    "incremental", cl::desc("Re-resolve only the indirect calls affected \
+    by the files changed since the last run with the summary cache, and \
+    write the changed edges to callgraph.delta"),
+    cl::init(false));
+
+cl::opt<unsigned> OutputShards(
+    "output-shards", cl::desc("Split BBMapping_later.json and ICInfo.json \
+    by input file into this many shards, indexed in BBMapping_later.index.json \
+    and ICInfo.index.json (0 writes single files)"),
+    cl::init(0));
+
+cl::opt<bool> InternStrings(
+    "intern-strings", cl::desc("Write paths, function names and block \
+    names in BBMapping_later.json, ICInfo.json and callgraph.txt as IDs \
+    into the tables of strings.json"),
+    cl::init(false));
+
 GlobalContext GlobalCtx;
 
 
-void IterativeModulePass::run(ModuleList &modules) {
+FuncSetRef FuncSetRef::get(const FuncSet &FS) {
+
+	typedef std::vector<Function *> SetT;
+
+	// Shared copies by the hash of their members. Entries of freed
+	// copies are dropped when their bucket is next visited.
+	static std::mutex Lock;
+	static DenseMap<size_t, SmallVector<std::weak_ptr<const SetT>, 1>> Sets;
+
+	FuncSetRef Ref;
+	if (FS.empty())
+		return Ref;
+
+	SetT Members(FS.begin(), FS.end());
+	std::sort(Members.begin(), Members.end());
+	size_t Hash = hash_combine_range(Members.begin(), Members.end());
+
+	std::lock_guard<std::mutex> Guard(Lock);
+	auto &Bucket = Sets[Hash];
+	for (auto It = Bucket.begin(); It != Bucket.end();) {
+		auto Set = It->lock();
+		if (!Set) {
+			It = Bucket.erase(It);
+			continue;
+		}
+		if (*Set == Members) {
+			Ref.Set = Set;
+			return Ref;
+		}
+		++It;
+	}
+
+	Ref.Set = std::shared_ptr<const SetT>(new SetT(std::move(Members)));
+	Bucket.push_back(Ref.Set);
+	return Ref;
+}
+
+
+unsigned IterativeModulePass::getNumWorkers(unsigned NumItems) {
+	return std::max(1u, std::min(NumThreads, NumItems));
+}
+
+void parallelFor(unsigned NumThreads, unsigned NumItems,
+		function_ref<void(unsigned, unsigned)> Fn,
+		function_ref<uint64_t(unsigned)> Cost) {
+
+	unsigned NumWorkers = std::max(1u, std::min(NumThreads, NumItems));
+
+	if (NumWorkers == 1) {
+		for (unsigned Idx = 0; Idx < NumItems; ++Idx)
+			Fn(0, Idx);
+		return;
+	}
+
+	// Heaviest items first
+	vector<unsigned> Order(NumItems);
+	std::iota(Order.begin(), Order.end(), 0);
+	if (Cost) {
+		vector<uint64_t> Costs(NumItems);
+		for (unsigned Idx = 0; Idx < NumItems; ++Idx)
+			Costs[Idx] = Cost(Idx);
+		std::stable_sort(Order.begin(), Order.end(),
+				[&](unsigned A, unsigned B) { return Costs[A] > Costs[B]; });
+	}
+
+	// The items are dealt to the workers' queues round-robin, so every
+	// worker starts with a heavy one. A worker takes the heaviest item
+	// of its own queue; once that is empty, it steals the lightest item
+	// of another worker.
+	struct WorkQueue {
+		std::mutex Lock;
+		std::deque<unsigned> Items;
+	};
+	vector<WorkQueue> Queues(NumWorkers);
+	for (unsigned i = 0; i < NumItems; ++i)
+		Queues[i % NumWorkers].Items.push_back(Order[i]);
+
+	auto Take = [](WorkQueue &Q, bool Own, unsigned &Idx) {
+		std::lock_guard<std::mutex> Guard(Q.Lock);
+		if (Q.Items.empty())
+			return false;
+		if (Own) {
+			Idx = Q.Items.front();
+			Q.Items.pop_front();
+		}
+		else {
+			Idx = Q.Items.back();
+			Q.Items.pop_back();
+		}
+		return true;
+	};
+
+	auto RunWorker = [&](unsigned W) {
+		TraceThread Trace;
+		unsigned Idx;
+		while (true) {
+			bool Found = Take(Queues[W], true, Idx);
+			for (unsigned i = 1; !Found && i < NumWorkers; ++i)
+				Found = Take(Queues[(W + i) % NumWorkers], false, Idx);
+			// No item is queued after the start, so all are taken
+			if (!Found)
+				return;
+			Fn(W, Idx);
+		}
+	};
+
+	ThreadPool Pool(hardware_concurrency(NumWorkers));
+	for (unsigned W = 0; W < NumWorkers; ++W)
+		Pool.async(RunWorker, W);
+	Pool.wait();
+}
+
+void IterativeModulePass::parallelForModules(ModuleList &modules,
+		function_ref<void(unsigned, unsigned)> Fn) {
+	computeModuleCosts(modules);
+	parallelFor(modules.size(), Fn, [&](unsigned Idx) {
+		return ModuleCosts.lookup(modules[Idx].first);
+	});
+}
+
+// Modules do not change once loaded, so their costs are computed in
+// parallel the first time they are dispatched
+void IterativeModulePass::computeModuleCosts(ModuleList &modules) {
+
+	vector<Module *> New;
+	for (auto &M : modules) {
+		if (!ModuleCosts.count(M.first))
+			New.push_back(M.first);
+	}
+	if (New.empty())
+		return;
+
+	PhaseTimer T("ComputeModuleCosts");
+	vector<uint64_t> Costs(New.size());
+	parallelFor(New.size(), [&](unsigned W, unsigned Idx) {
+		Costs[Idx] = getModuleCost(New[Idx]);
+	});
+	for (unsigned Idx = 0; Idx < New.size(); ++Idx)
+		ModuleCosts[New[Idx]] = Costs[Idx];
+}
+
+uint64_t IterativeModulePass::getFunctionCost(Function *F) {
+
+	// Call sites weigh more, as resolving them dominates the analysis.
+	uint64_t Cost = 1;
+	for (Instruction &I : instructions(F))
+		Cost += isa<CallBase>(I) ? 8 : 1;
+	return Cost;
+}
+
+uint64_t IterativeModulePass::getModuleCost(Module *M) {
+
+	uint64_t Cost = 0;
+	for (Function &F : *M)
+		Cost += getFunctionCost(&F);
+	return Cost;
+}
+
+void IterativeModulePass::initializeModules(ModuleList &modules) {
 
 	ModuleList::iterator i, e;
-	OP << "[" << ID << "] Initializing " << modules.size() << " modules ";
 	bool again = true;
 	while (again) {
 		again = false;
+		ProgressReporter Progress(ID, modules.size());
 		for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+			PhaseTimer T("doInitialization", i->second);
 			again |= doInitialization(i->first);
-			OP << ".";
+			Progress.advance();
 		}
 	}
-	OP << "\n";
+}
+
+unsigned IterativeModulePass::iterateModules(ModuleList &modules,
+		unsigned iter) {
+
+	unsigned changed = 0;
+	unsigned counter_modules = 0;
+	unsigned total_modules = modules.size();
+	ProgressReporter Progress(string(ID) + " / " + std::to_string(iter),
+			total_modules);
+	for (auto i = modules.begin(), e = modules.end(); i != e; ++i) {
+		KA_LOG(LL_Verbose) << "[" << ID << " / " << iter << "] "
+			<< "[" << ++counter_modules << " / " << total_modules << "] "
+			<< "[" << i->second << "]\n";
+
+		PhaseTimer T("doModulePass", i->second);
+		bool ret = doModulePass(i->first);
+		if (ret) {
+			++changed;
+			KA_LOG(LL_Verbose) << "\t [CHANGED]\n";
+		}
+		Progress.advance();
+	}
+	return changed;
+}
+
+void IterativeModulePass::run(ModuleList &modules) {
+
+	ModuleList::iterator i, e;
+	OP << "[" << ID << "] Initializing " << modules.size() << " modules\n";
+	flushLog();
+	{
+		PhaseTimer T("Initialize");
+		initializeModules(modules);
+	}
 
 	unsigned iter = 0, changed = 1;
 	while (changed) {
 		++iter;
-		changed = 0;
-		unsigned counter_modules = 0;
-		unsigned total_modules = modules.size();
-		for (i = modules.begin(), e = modules.end(); i != e; ++i) {
-			OP << "[" << ID << " / " << iter << "] ";
-			OP << "[" << ++counter_modules << " / " << total_modules << "] ";
-			OP << "[" << i->second << "]\n";
-
-			bool ret = doModulePass(i->first);
-			if (ret) {
-				++changed;
-				OP << "\t [CHANGED]\n";
-			} else
-				OP << "\n";
-		}
+		PhaseTimer T("Iterate", std::to_string(iter));
+		changed = iterateModules(modules, iter);
 		OP << "[" << ID << "] Updated in " << changed << " modules.\n";
 	}
 
 	OP << "[" << ID << "] Postprocessing ...\n";
-	again = true;
+	PhaseTimer T("Finalize");
+	bool again = true;
 	while (again) {
 		again = false;
 		for (i = modules.begin(), e = modules.end(); i != e; ++i) {
@@ -96,6 +372,7 @@ void IterativeModulePass::run(ModuleList &modules) {
 	}
 
 	OP << "[" << ID << "] Done!\n\n";
+	flushLog();
 }
 
 
@@ -104,15 +381,65 @@ void IterativeModulePass::run(ModuleList &modules) {
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/FileSystem.h"
 
+// The strings the outputs are interned in, NULL without -intern-strings
+ExportStrings *getExportStrings() {
+	static ExportStrings Strings;
+	return InternStrings ? &Strings : NULL;
+}
+
+void saveExportStrings() {
+
+	PhaseTimer T("WriteStrings");
+	ExportStrings *Strings = getExportStrings();
+	std::error_code EC;
+	raw_fd_ostream Out("strings.json", EC, sys::fs::OF_Text);
+	if (EC) {
+		KA_LOG(LL_Error) << "无法打开输出文件: " << EC.message() << "\n";
+		return;
+	}
+	json::OStream J(Out, 1);
+	auto WriteTable = [&](StringRef Key, StringTable &Table) {
+		J.attributeArray(Key, [&] {
+			for (StringRef Str : Table.getStrings())
+				J.value(Str);
+		});
+	};
+	J.object([&] {
+		WriteTable("paths", Strings->Paths);
+		WriteTable("functions", Strings->Functions);
+		WriteTable("blocks", Strings->Blocks);
+	});
+	Out << "\n";
+	OP << "String tables saved as strings.json\n";
+}
+
+// Edges of the call graph as IDs of the names of their functions. The
+// edges are sorted by the names first, so that the IDs do not depend on
+// the order of Callees.
+static void dumpInternedCallgraph(raw_ostream &Out, GlobalContext *GCtx,
+		ExportStrings *Strings) {
+
+	vector<pair<StringRef, StringRef>> Edges;
+	for (auto &entry : GCtx->Callees) {
+		for (auto *CalleeF : entry.second) {
+			if (!CalleeF->isIntrinsic())
+				Edges.push_back(make_pair(entry.first->getFunction()->getName(),
+							CalleeF->getName()));
+		}
+	}
+	std::sort(Edges.begin(), Edges.end());
+	for (auto &E : Edges) {
+		Out << Strings->Functions.intern(E.first) << " -> "
+			<< Strings->Functions.intern(E.second) << "\n";
+	}
+}
+
 // 假设 GCtx 是你的 GlobalContext*，并且已经填充好了 Callees
 
-void dumpCallgraphToFile(GlobalContext *GCtx) {
-    // 打开文件
-    std::error_code EC;
-    llvm::raw_fd_ostream Out("callgraph.txt", EC,
-                             llvm::sys::fs::OF_Text | llvm::sys::fs::OF_Append);
-    if (EC) {
-        llvm::errs() << "无法打开输出文件: " << EC.message() << "\n";
+void dumpCallgraph(raw_ostream &Out, GlobalContext *GCtx) {
+    PhaseTimer T("WriteCallgraph");
+    if (ExportStrings *Strings = getExportStrings()) {
+        dumpInternedCallgraph(Out, GCtx, Strings);
         return;
     }
 
@@ -133,22 +460,89 @@ void dumpCallgraphToFile(GlobalContext *GCtx) {
                 << "\n";
         }
     }
+}
+
+void dumpCallgraphToFile(GlobalContext *GCtx) {
+    // 打开文件
+    std::error_code EC;
+    llvm::raw_fd_ostream Out("callgraph.txt", EC,
+                             llvm::sys::fs::OF_Text);
+    if (EC) {
+        KA_LOG(LL_Error) << "无法打开输出文件: " << EC.message() << "\n";
+        return;
+    }
+
+    dumpCallgraph(Out, GCtx);
 
     Out.close();
     llvm::outs() << "Callgraph 已写入 callgraph.txt\n";
 }
 
+// Local functions are told apart by their modules
+static unsigned addCallgraphFunction(CallGraphFileWriter &CGW, Function *F) {
 
-void PrintResults(GlobalContext *GCtx) {
+	StringRef Scope;
+	if (F->hasLocalLinkage())
+		Scope = F->getParent()->getModuleIdentifier();
+	string File;
+	unsigned Line = 0;
+	if (DISubprogram *SP = F->getSubprogram()) {
+		File = getSourcePath(SP->getDirectory(), SP->getFilename());
+		Line = SP->getLine();
+	}
+	return CGW.addFunction(F->getName(), Scope, File, Line);
+}
 
-	int TotalTargets = 0;
-	for (auto IC : GCtx->IndirectCallInsts) {
-		TotalTargets += GCtx->Callees[IC].size();
+// Add the functions of modules and the call sites in Callees
+void addCallgraphRecords(CallGraphFileWriter &CGW, GlobalContext *GCtx,
+		ModuleList &Modules) {
+
+	PhaseTimer T("CollectCallgraphRecords");
+
+	for (auto &M : Modules) {
+		for (Function &F : *M.first) {
+			if (!F.isDeclaration())
+				addCallgraphFunction(CGW, &F);
+		}
 	}
-	float AveIndirectTargets = 0.0;
-	if (GCtx->NumValidIndirectCalls)
-		AveIndirectTargets =
-			(float)GCtx->NumIndirectCallTargets/GCtx->IndirectCallInsts.size();
+
+	for (auto &entry : GCtx->Callees) {
+		CallInst *CI = entry.first;
+		if (isa<IntrinsicInst>(CI))
+			continue;
+
+		vector<unsigned> Targets;
+		for (Function *CalleeF : entry.second) {
+			if (!CalleeF->isIntrinsic())
+				Targets.push_back(addCallgraphFunction(CGW, CalleeF));
+		}
+		string File;
+		unsigned Line = 0, Column = 0;
+		if (DILocation *Loc = CI->getDebugLoc().get()) {
+			File = getSourcePath(Loc->getDirectory(), Loc->getFilename());
+			Line = Loc->getLine();
+			Column = Loc->getColumn();
+		}
+		CGW.addCallSite(addCallgraphFunction(CGW, CI->getFunction()), File,
+				Line, Column, CI->isIndirectCall() ? cgfile::SF_Indirect : 0,
+				std::move(Targets));
+	}
+}
+
+void saveCallgraphBinary(CallGraphFileWriter &CGW) {
+
+	PhaseTimer T("WriteCallgraphBinary");
+
+	std::string Error;
+	if (!CGW.write(CallgraphBinary, Error)) {
+		KA_LOG(LL_Error) << "无法写入 " << CallgraphBinary << ": " << Error << "\n";
+		return;
+	}
+	outs() << "Callgraph 已写入 " << CallgraphBinary << "\n";
+}
+
+// Number of callees of the indirect calls
+unsigned countFinalCallees(GlobalContext *GCtx) {
 
 	int totalsize = 0;
 	for (auto &curEle: GCtx->Callees) {
@@ -156,11 +550,17 @@ void PrintResults(GlobalContext *GCtx) {
 			totalsize += curEle.second.size();
 		}
 	}
+	return totalsize;
+}
+
+void printStatistics(GlobalContext *GCtx, size_t NumIndirectCalls,
+		unsigned totalsize) {
+
 	OP << "\n@@ Total number of final callees: " << totalsize << ".\n";
 
 	OP<<"############## Result Statistics ##############\n";
 	//cout<<"# Ave. Number of indirect-call targets: \t"<<std::setprecision(5)<<AveIndirectTargets<<"\n";
-	OP<<"# Number of indirect calls: \t\t\t"<<GCtx->IndirectCallInsts.size()<<"\n";   
+	OP<<"# Number of indirect calls: \t\t\t"<<NumIndirectCalls<<"\n";   
 	OP<<"# Number of indirect calls with targets: \t"<<GCtx->NumValidIndirectCalls<<"\n";
 	OP<<"# Number of indirect-call targets: \t\t"<<GCtx->NumIndirectCallTargets<<"\n";
 	OP<<"# Number of address-taken functions: \t\t"<<GCtx->AddressTakenFuncs.size()<<"\n";
@@ -168,16 +568,31 @@ void PrintResults(GlobalContext *GCtx) {
 	OP<<"# Number of multi-layer targets: \t\t"<<GCtx->NumSecondLayerTargets<<"\n";  
 	OP<<"# Number of one-layer calls: \t\t\t"<<GCtx->NumFirstLayerTypeCalls<<"\n";
 	OP<<"# Number of one-layer targets: \t\t\t"<<GCtx->NumFirstLayerTargets<<"\n";
+}
+
+void PrintResults(GlobalContext *GCtx) {
+
+	int TotalTargets = 0;
+	for (auto IC : GCtx->IndirectCallInsts) {
+		TotalTargets += GCtx->Callees[IC].size();
+	}
+	float AveIndirectTargets = 0.0;
+	if (GCtx->NumValidIndirectCalls)
+		AveIndirectTargets =
+			(float)GCtx->NumIndirectCallTargets/GCtx->IndirectCallInsts.size();
 
+	printStatistics(GCtx, GCtx->IndirectCallInsts.size(),
+			countFinalCallees(GCtx));
 
 	dumpCallgraphToFile(GCtx);
 }
 
-void getIndirectCall(GlobalContext *GCtx) {
-	std::vector<ICInfo> ICs;
-	for (auto& IC : GCtx->IndirectCallInsts) {
+// Collect the info of the indirect calls of a module
+void getIndirectCallInfo(GlobalContext *GCtx, ArrayRef<CallInst *> ICalls,
+		vector<ICInfo> &Infos) {
+	for (auto& IC : ICalls) {
 		ICInfo info;
-		info.BBName = IC->getParent()->getParent()->getName().str() + "&" + IC->getParent()->getName().str();
+		info.name = BBName(IC->getFunction()->getName(), IC->getParent()->getName());
 
 
 		// get the debug info (path and line number) of this indirect call instruction
@@ -186,7 +601,7 @@ void getIndirectCall(GlobalContext *GCtx) {
 			if (N) {
 				DILocation* Loc = cast<DILocation>(N);
 				if (Loc->getLine() != 0)
-					info.lines.insert(Loc->getLine());
+					info.lines.push_back(Loc->getLine());
 				if (info.path == "") {
 					std::string path = Loc->getFilename().str();
 					// remove any "./" substr in the path
@@ -196,146 +611,440 @@ void getIndirectCall(GlobalContext *GCtx) {
 			}
 		}
 
-		for (Function* callee : GCtx->Callees[IC]) {
-			info.callees.insert(callee->getName().str());
+		auto CIt = GCtx->Callees.find(IC);
+		if (CIt != GCtx->Callees.end()) {
+			for (Function* callee : CIt->second) {
+				info.callees.push_back(callee->getName());
+			}
 		}
-		ICs.push_back(info);
-	}
-	
-	if (ICs.size() != GCtx->IndirectCallInsts.size()) {
-		OP << "Warning: the number of indirect call instructions and the number of indirect call info do not match.\n";
-		OP << "Indirect Call Instructions: " << GCtx->IndirectCallInsts.size() << "\n";
-		OP << "Indirect Call Info: " << ICs.size() << "\n";
+		Infos.push_back(std::move(info));
 	}
-
-	// save the mapping as a JSON file
-	std::string filename = "ICInfo.json";
-	std::ofstream outFile(filename);
-	writeICToJson(outFile, ICs);
-	OP << "Indirect Call Info saved as " << filename << "\n";
 }
 
-std::unordered_map<std::string, BBInfo> BBMapping;
-
-void getBBMapping(GlobalContext *GCtx) {
-	// 1. set up the mapping for each basic block, leave the successors blank for now
-	OP << "\n\n############## Basic Block Mapping ##############\n";
-	for(auto &M : GCtx->Modules) {
-		Module *module = M.first;
-
-		for (Function& func : *module) {
+// Collect the basic blocks of a module with their successors, a
+// function at a time. Functions of the same name in several modules get
+// records of their own.
+void getBBMapping(GlobalContext *GCtx, Module *module,
+		vector<BBInfo> &Infos) {
+	for (Function& func : *module) {
+		#if DEBUG_MAPPING
+		OP << "\n\nFunction: " << func.getName() << "\n";
+		#endif
+		if (func.getBasicBlockList().size() == 0) {
 			#if DEBUG_MAPPING
-			OP << "\n\nFunction: " << func.getName() << "\n";
+			OP << "No basic block in function " << func.getName() << "\n";
 			#endif
-			if (func.getBasicBlockList().size() == 0) {
-				#if DEBUG_MAPPING
-				OP << "No basic block in function " << func.getName() << "\n";
-				#endif
-				continue;
+			continue;
+		}
+
+#ifdef UNROLL_LOOP_ONCE
+		// Loops are unrolled once in a view of the CFG
+		UnrolledCFG CFG(&func);
+#endif
+
+		// traverse each basic block
+		for (BasicBlock& bb : func) {
+			BBInfo info;
+			info.name = BBName(func.getName(), bb.getName());
+			info.path = "";
+
+			// 1. intra-function basic block successors
+			SmallVector<BasicBlock *, 2> succs;
+#ifdef UNROLL_LOOP_ONCE
+			CFG.getSuccessors(&bb, succs);
+#else
+			succs.append(succ_begin(&bb), succ_end(&bb));
+#endif
+			for (BasicBlock* succ : succs) {
+				info.successors.push_back(BBName(func.getName(), succ->getName()));
 			}
 
-			// traverse each basic block
-			for (BasicBlock& bb : func) {
-				BBInfo info;
-				info.name = func.getName().str() + "&" + bb.getName().str();
-				info.path = "";
-				for (Instruction& inst : bb) {
-					MDNode *N = inst.getMetadata("dbg");
-					if (N) {
-						DILocation* Loc = cast<DILocation>(N);
-						if (Loc->getLine() != 0)
-							info.lines.insert(Loc->getLine());
-						if (info.path == "") {
-							std::string path = Loc->getFilename().str();
-							// remove any "./" substr in the path
-							OP << "dbg path before: " << path << "\n";
-							path = cleanPath(path);
-							OP << "dbg path after: " << path << "\n";
-							info.path = Loc->getDirectory().str() + "/" + path;
-							
-							OP << "dbg directory: " << Loc->getDirectory().str() << "\n";
-							OP << "result path: " << info.path << "\n\n";
-						}
+			for (Instruction& inst : bb) {
+				MDNode *N = inst.getMetadata("dbg");
+				if (N) {
+					DILocation* Loc = cast<DILocation>(N);
+					if (Loc->getLine() != 0)
+						info.lines.push_back(Loc->getLine());
+					if (info.path == "") {
+						std::string path = Loc->getFilename().str();
+						// remove any "./" substr in the path
+						#if DEBUG_MAPPING
+						OP << "dbg path before: " << path << "\n";
+						#endif
+						path = cleanPath(path);
+						info.path = Loc->getDirectory().str() + "/" + path;
+						#if DEBUG_MAPPING
+						OP << "dbg path after: " << path << "\n";
+						OP << "dbg directory: " << Loc->getDirectory().str() << "\n";
+						OP << "result path: " << info.path << "\n\n";
+						#endif
 					}
 				}
-				BBMapping[info.name] = info;
+
+				// 2. inter-function basic block successors
+				CallInst *callInst = dyn_cast<CallInst>(&inst);
+				if (!callInst)
+					continue;
+				auto CIt = GCtx->Callees.find(callInst);
+				if (CIt == GCtx->Callees.end())
+					continue;
+				#if DEBUG_INDIRECT_MAPPING
+				// check if the current call instruction is an indirect call
+				if (callInst->isIndirectCall()) {
+					OP << "Indirect Call: " << *callInst << "\n";
+				}
+				#endif
+				for (Function* callee : CIt->second) {
+					// check if the callee has an entry block
+					if (callee->getBasicBlockList().size() == 0) {
+						continue;
+					}
+
+					BasicBlock& entry = callee->getEntryBlock();
+					info.successors.push_back(BBName(callee->getName(), entry.getName()));
+
+					#if DEBUG_INDIRECT_MAPPING
+					OP << "\t" << callee->getName().str() + "&" + entry.getName().str() << "\n";
+					#endif
+				}
 			}
+			Infos.push_back(std::move(info));
 		}
 	}
-	#if DEBUG_MAPPING
-	OP << "Basic Block Mapping set up complete.\n";
-	#endif
-
-	// 2. set up the successors for each basic block
-	#if DEBUG_MAPPING
-	OP << "\n\n############## Basic Block Successors ##############\n";
-	#endif
-	for(auto &M : GCtx->Modules) {
-		Module *module = M.first;
-		for (Function& func : *module) {
-			#if DEBUG_MAPPING
-			OP << "\n\nFunction: " << func.getName() << "\n";
-			#endif
-			if (func.getBasicBlockList().size() == 0) {
-				#if DEBUG_MAPPING
-				OP << "No basic block in function " << func.getName() << "\n";
-				#endif
-				continue;
-			}
+}
+
+// Position of an input file on the command line
+static unsigned getInputIndex(StringRef File) {
+	static StringMap<unsigned> Indexes;
+	if (Indexes.empty()) {
+		for (unsigned i = 0; i < InputFilenames.size(); ++i)
+			Indexes.try_emplace(InputFilenames[i], i);
+	}
+	return Indexes.lookup(File);
+}
+
+//
+// The records of an output, written to Name.json, or split by input
+// file into NumShards shards Name.<k>.json, which are listed with the
+// modules and the number of records of each in Name.index.json.
+// Records refer to Strings by IDs if it is given.
+//
+class RecordOutput {
+
+	struct Shard {
+		string File;
+		std::error_code EC;
+		unique_ptr<raw_fd_ostream> OS;
+		unique_ptr<JsonRecordWriter> W;
+		vector<string> Modules;
+	};
+
+	string Title, Name;
+	vector<Shard> Shards;
+	// Nothing may be written to a stream that failed to open
+	raw_null_ostream NullOut;
+
+public:
+
+	RecordOutput(StringRef Title_, StringRef Name_, unsigned NumShards,
+			ExportStrings *Strings) : Title(Title_), Name(Name_) {
+
+		NumShards = std::min<unsigned>(NumShards, InputFilenames.size());
+		Shards.resize(std::max(1u, NumShards));
+		for (unsigned k = 0; k < Shards.size(); ++k) {
+			Shard &S = Shards[k];
+			S.File = NumShards ? Name + "." + std::to_string(k) + ".json"
+				: Name + ".json";
+			S.OS.reset(new raw_fd_ostream(S.File, S.EC, sys::fs::OF_Text));
+			if (S.EC)
+				KA_LOG(LL_Error) << "无法打开输出文件: " << S.EC.message() << "\n";
+			S.W.reset(new JsonRecordWriter(S.EC ? (raw_ostream &)NullOut
+						: *S.OS, true, Strings));
+		}
+	}
+
+	// The writer of the records of a module of an input file
+	JsonRecordWriter &addModule(StringRef File) {
+		Shard &S = Shards[(uint64_t)getInputIndex(File) * Shards.size()
+			/ InputFilenames.size()];
+		S.Modules.push_back(File.str());
+		return *S.W;
+	}
+
+	void finish() {
+
+		bool Failed = false;
+		for (auto &S : Shards) {
+			S.W->finish();
+			if (S.EC)
+				Failed = true;
+			else
+				S.OS->close();
+		}
+		if (Failed)
+			return;
+		if (Shards.size() == 1 && !OutputShards) {
+			OP << Title << " saved as " << Shards[0].File << "\n";
+			return;
+		}
 
-			for (BasicBlock& bb : func) {
-				BBInfo& info = BBMapping[func.getName().str() + "&" + bb.getName().str()];
-				// 2.1 intra-function basic block successors
-				for (BasicBlock* succ : successors(&bb)) {
-					info.successors.insert(func.getName().str() + "&" + succ->getName().str());
+		string IndexFile = Name + ".index.json";
+		std::error_code EC;
+		raw_fd_ostream Out(IndexFile, EC, sys::fs::OF_Text);
+		if (EC) {
+			KA_LOG(LL_Error) << "无法打开输出文件: " << EC.message() << "\n";
+			return;
+		}
+		json::OStream J(Out, 2);
+		J.object([&] {
+			J.attributeArray("shards", [&] {
+				for (auto &S : Shards) {
+					J.object([&] {
+						J.attribute("file", S.File);
+						J.attribute("records", (int64_t)S.W->getNumRecords());
+						J.attributeArray("modules", [&] {
+							for (auto &M : S.Modules)
+								J.value(M);
+						});
+					});
 				}
-				#if DEBUG_MAPPING
-				OP << "intra-function basic block successors set up complete.\n";
-				#endif
-				// 2.2 inter-function basic block successors
-				for (Instruction& inst : bb) {
-					if (CallInst *callInst = dyn_cast<CallInst>(&inst)) {
-						if (GCtx->Callees.find(callInst) != GCtx->Callees.end()) {
-							#if DEBUG_INDIRECT_MAPPING
-							// check if the current call instruction is an indirect call
-							if (callInst->isIndirectCall()) {
-								OP << "Indirect Call: " << *callInst << "\n";
-							}
-							#endif
-							for (Function* callee : GCtx->Callees[callInst]) {
-								// check if the callee has an entry block
-								if (callee->getBasicBlockList().size() == 0) {
-									continue;
-								}
-
-								BasicBlock& entry = callee->getEntryBlock();
-								info.successors.insert(callee->getName().str() + "&" + entry.getName().str());
-
-								#if DEBUG_INDIRECT_MAPPING
-								OP << "\t" << callee->getName().str() + "&" + entry.getName().str() << "\n";
-								#endif
-							}
-						}
-					}
+			});
+		});
+		Out << "\n";
+		OP << Title << " saved as " << Shards.size() << " shard(s) indexed in "
+			<< IndexFile << "\n";
+	}
+};
+
+// Write the records of modules to the outputs. Modules are rendered in
+// parallel, a batch at a time to bound the memory of the rendered
+// records, which are then added in the order of the modules, so that
+// the outputs do not depend on the threads. Interning Strings is left
+// to the adding, which makes the IDs deterministic too.
+void writeModuleRecords(ModuleList &modules, GlobalContext *GCtx,
+		RecordOutput &BBOut, RecordOutput &ICOut, ExportStrings *Strings) {
+
+	DenseMap<Module *, vector<CallInst *>> ICalls;
+	for (auto IC : GCtx->IndirectCallInsts)
+		ICalls[IC->getModule()].push_back(IC);
+
+	struct Records {
+		vector<BBInfo> BBInfos;
+		vector<ICInfo> ICInfos;
+		string BB, IC;
+		unsigned NumBB = 0, NumIC = 0;
+	};
+
+	PhaseTimer T("WriteRecords");
+	ProgressReporter Progress("Output", modules.size());
+	size_t BatchSize = GCtx->NumThreads * 4;
+	for (size_t Begin = 0; Begin < modules.size(); Begin += BatchSize) {
+
+		unsigned N = std::min(BatchSize, modules.size() - Begin);
+		vector<Records> Batch(N);
+		parallelFor(GCtx->NumThreads, N, [&](unsigned W, unsigned i) {
+			Module *M = modules[Begin + i].first;
+			StringRef File = modules[Begin + i].second;
+			Records &R = Batch[i];
+			{
+				PhaseTimer T("BBMapping", File);
+				getBBMapping(GCtx, M, R.BBInfos);
+				if (!Strings) {
+					raw_string_ostream BBOS(R.BB);
+					JsonRecordWriter BBW(BBOS, false);
+					for (auto &Info : R.BBInfos)
+						BBW.write(Info);
+					R.NumBB = BBW.getNumRecords();
+					R.BBInfos.clear();
 				}
-				#if DEBUG_MAPPING
-				OP << "inter-function basic block successors set up complete.\n";
-				#endif
 			}
+
+			PhaseTimer T("ICInfo", File);
+			auto It = ICalls.find(M);
+			if (It != ICalls.end())
+				getIndirectCallInfo(GCtx, It->second, R.ICInfos);
+			if (!Strings) {
+				raw_string_ostream ICOS(R.IC);
+				JsonRecordWriter ICW(ICOS, false);
+				for (auto &Info : R.ICInfos)
+					ICW.write(Info);
+				R.NumIC = ICW.getNumRecords();
+				R.ICInfos.clear();
+			}
+		}, [&](unsigned i) {
+			return (uint64_t)modules[Begin + i].first->getInstructionCount();
+		});
+
+		for (unsigned i = 0; i < N; ++i) {
+			StringRef File = modules[Begin + i].second;
+			Records &R = Batch[i];
+			JsonRecordWriter &BBW = BBOut.addModule(File);
+			JsonRecordWriter &ICW = ICOut.addModule(File);
+			if (!Strings) {
+				BBW.append(R.BB, R.NumBB);
+				ICW.append(R.IC, R.NumIC);
+				continue;
+			}
+			for (auto &Info : R.BBInfos)
+				BBW.write(Info);
+			for (auto &Info : R.ICInfos)
+				ICW.write(Info);
 		}
+		Progress.advance(N);
+	}
+}
+
+Module *loadModule(const string &File) {
+
+	SMDiagnostic Err;
+	LLVMContext *LLVMCtx = new LLVMContext();
+	unique_ptr<Module> M = parseIRFile(File, Err, *LLVMCtx);
+	if (!M)
+		delete LLVMCtx;
+	return M.release();
+}
+
+void releaseModule(Module *M) {
+
+	LLVMContext *LLVMCtx = &M->getContext();
+	forgetTypeHashes(LLVMCtx);
+	delete M;
+	delete LLVMCtx;
+}
+
+// Parse the bitcode files with a pool of loader threads. Every module
+// gets its own LLVMContext, so the files can be parsed concurrently;
+// the parsed modules are then added to the global context in the
+// order of the command line.
+void loadModules(GlobalContext *GCtx, const char *ProgName) {
+
+	PhaseTimer T("LoadModules");
+
+	unsigned NumFiles = InputFilenames.size();
+	vector<unique_ptr<Module>> Loaded(NumFiles);
+
+	auto LoadFile = [&](unsigned i) {
+		PhaseTimer T("LoadModule", InputFilenames[i]);
+		Loaded[i].reset(loadModule(InputFilenames[i]));
+	};
+
+	if (GCtx->NumThreads == 1 || NumFiles < 2) {
+		for (unsigned i = 0; i < NumFiles; ++i)
+			LoadFile(i);
+	}
+	else {
+		ThreadPool Pool(hardware_concurrency(GCtx->NumThreads));
+		for (unsigned i = 0; i < NumFiles; ++i) {
+			Pool.async([&](unsigned i) {
+				TraceThread Trace;
+				LoadFile(i);
+			}, i);
+		}
+		Pool.wait();
+	}
+
+	for (unsigned i = 0; i < NumFiles; ++i) {
+
+		if (Loaded[i] == NULL) {
+			KA_LOG(LL_Error) << ProgName << ": error loading file '"
+				<< InputFilenames[i] << "'\n";
+			continue;
+		}
+
+		Module *Module = Loaded[i].release();
+		StringRef MName = StringRef(strdup(InputFilenames[i].data()));
+		GCtx->Modules.push_back(std::make_pair(Module, MName));
+		GCtx->ModuleMaps[Module] = InputFilenames[i];
+	}
+}
+
+// Write the edges added and removed since the last run
+void saveEdgeDelta(CallGraphPass &CGPass) {
+
+	set<pair<string, string>> Added, Removed;
+	CGPass.getEdgeDelta(Added, Removed);
+
+	std::error_code EC;
+	raw_fd_ostream Out("callgraph.delta", EC, sys::fs::OF_Text);
+	if (EC) {
+		KA_LOG(LL_Error) << "无法打开输出文件: " << EC.message() << "\n";
+		return;
+	}
+	for (auto &E : Added)
+		Out << "+ " << E.first << " -> " << E.second << "\n";
+	for (auto &E : Removed)
+		Out << "- " << E.first << " -> " << E.second << "\n";
+	outs() << "Callgraph 变化已写入 callgraph.delta ("
+		<< Added.size() << " added, " << Removed.size() << " removed)\n";
+}
+
+// Build the call graph with only a window of modules in memory at a
+// time. The outputs are collected window by window before the modules
+// are freed.
+void runBoundedMemory(GlobalContext *GCtx) {
+
+	OP << "Total " << InputFilenames.size() << " file(s)\n";
+	vector<string> Files(InputFilenames.begin(), InputFilenames.end());
+
+	std::error_code EC;
+	raw_fd_ostream CGOut("callgraph.txt", EC, sys::fs::OF_Text);
+	if (EC)
+		KA_LOG(LL_Error) << "无法打开输出文件: " << EC.message() << "\n";
+
+	RecordOutput BBOut("Basic Block Mapping", "BBMapping_later", OutputShards,
+			getExportStrings());
+	RecordOutput ICOut("Indirect Call Info", "ICInfo", OutputShards,
+			getExportStrings());
+
+	size_t NumIndirectCalls = 0;
+	unsigned NumFinalCallees = 0;
+
+	OP << "\n\n############## Basic Block Mapping ##############\n";
+	CallGraphPass CGPass(GCtx);
+	CallGraphFileWriter CGW;
+	CGPass.runBounded(Files, SummaryCacheDir, Incremental,
+			[&](ModuleList &modules) {
+		NumIndirectCalls += GCtx->IndirectCallInsts.size();
+		NumFinalCallees += countFinalCallees(GCtx);
+		if (!EC)
+			dumpCallgraph(CGOut, GCtx);
+		writeModuleRecords(modules, GCtx, BBOut, ICOut, getExportStrings());
+		if (!CallgraphBinary.empty())
+			addCallgraphRecords(CGW, GCtx, modules);
+	});
+
+	printStatistics(GCtx, NumIndirectCalls, NumFinalCallees);
+	if (!EC) {
+		CGOut.close();
+		outs() << "Callgraph 已写入 callgraph.txt\n";
+	}
+
+	BBOut.finish();
+	ICOut.finish();
+	if (InternStrings)
+		saveExportStrings();
+	if (!CallgraphBinary.empty())
+		saveCallgraphBinary(CGW);
+
+	if (Incremental)
+		saveEdgeDelta(CGPass);
+}
+
+// Write the time trace and the time summary of the run
+void finishTiming() {
+
+	if (TimeTrace) {
+		std::string Error;
+		if (writeTimeTrace(TimeTraceFile, Error))
+			OP << "Time trace saved as " << TimeTraceFile << "\n";
+		else
+			KA_LOG(LL_Error) << "无法写入 " << TimeTraceFile << ": " << Error
+				<< "\n";
+	}
+	if (TimeSummary) {
+		flushLog();
+		printTimeSummary(errs());
 	}
-	#if DEBUG_MAPPING
-	OP << "Basic Block Successors set up complete.\n";
-	#endif
-	// 3. save the mapping as a JSON file
-	#if DEBUG_MAPPING
-	OP << "\n\n############## Save Mapping as a JSON file ##############\n";
-	#endif
-	string filename = "BBMapping_later.json";
-	// std::ofstream outFile("BBMapping.json");
-	std::ofstream outFile(filename);
-	writeMappingToJson(outFile, BBMapping);
-	OP << "Basic Block Mapping saved as " << filename << "\n";
 }
 
 int main(int argc, char **argv) {
@@ -347,34 +1056,53 @@ int main(int argc, char **argv) {
 	llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
 
 	cl::ParseCommandLineOptions(argc, argv, "global analysis\n");
-	SMDiagnostic Err;
 
-	// Loading modules
-	OP << "Total " << InputFilenames.size() << " file(s)\n";
+	setLogLevel(LogLevelOpt);
+	setProgressInterval(ProgressInterval);
+	if (TimeTrace)
+		startTimeTrace(TimeTraceGranularity);
+	if (TimeSummary)
+		startTimeSummary();
 
-	for (unsigned i = 0; i < InputFilenames.size(); ++i) {
+	GlobalCtx.NumThreads = NumThreads ? NumThreads
+		: hardware_concurrency().compute_thread_count();
 
-		LLVMContext *LLVMCtx = new LLVMContext();
-		std::unique_ptr<Module> M = parseIRFile(InputFilenames[i], Err, *LLVMCtx);
+	ENABLE_MLTA = MLTA;
+	LAYER_WALK_BUDGET = LayerWalkBudget;
 
-		if (M == NULL) {
-			OP << argv[0] << ": error loading file '"
-				<< InputFilenames[i] << "'\n";
-			continue;
+	if (BoundedMemory) {
+		// Fuzzy type matching needs the function types of all modules
+		if (ENABLE_MLTA == 0) {
+			errs() << argv[0] << ": -bounded-memory requires -mlta > 0\n";
+			return 1;
 		}
-
-		Module *Module = M.release();
-		StringRef MName = StringRef(strdup(InputFilenames[i].data()));
-		GlobalCtx.Modules.push_back(std::make_pair(Module, MName));
-		GlobalCtx.ModuleMaps[Module] = InputFilenames[i];
+		if (Incremental && SummaryCacheDir.empty()) {
+			errs() << argv[0] << ": -incremental requires -summary-cache\n";
+			return 1;
+		}
+		if (!ServeSocket.empty()) {
+			errs() << argv[0] << ": -serve needs all modules in memory, "
+				<< "which -bounded-memory does not keep\n";
+			return 1;
+		}
+		runBoundedMemory(&GlobalCtx);
+		finishTiming();
+		return 0;
+	}
+	if (!SummaryCacheDir.empty() || Incremental) {
+		errs() << argv[0] << ": -summary-cache and -incremental require "
+			<< "-bounded-memory\n";
+		return 1;
 	}
 
+	// Loading modules
+	OP << "Total " << InputFilenames.size() << " file(s)\n";
+	loadModules(&GlobalCtx, argv[0]);
+
 	//
 	// Main workflow
 	//
 
-	ENABLE_MLTA = MLTA;
-
 	// Build global callgraph.
 	CallGraphPass CGPass(&GlobalCtx);
 	CGPass.run(GlobalCtx.Modules);
@@ -382,9 +1110,31 @@ int main(int argc, char **argv) {
 	// Print final results
 	PrintResults(&GlobalCtx);
 
-	getBBMapping(&GlobalCtx);
+	if (!CallgraphBinary.empty()) {
+		CallGraphFileWriter CGW;
+		addCallgraphRecords(CGW, &GlobalCtx, GlobalCtx.Modules);
+		saveCallgraphBinary(CGW);
+	}
+
+	OP << "\n\n############## Basic Block Mapping ##############\n";
+	{
+		RecordOutput BBOut("Basic Block Mapping", "BBMapping_later",
+				OutputShards, getExportStrings());
+		RecordOutput ICOut("Indirect Call Info", "ICInfo", OutputShards,
+				getExportStrings());
+		writeModuleRecords(GlobalCtx.Modules, &GlobalCtx, BBOut, ICOut,
+				getExportStrings());
+		BBOut.finish();
+		ICOut.finish();
+	}
+	if (InternStrings)
+		saveExportStrings();
+	finishTiming();
 
-	getIndirectCall(&GlobalCtx);
+	if (!ServeSocket.empty()) {
+		QueryServer Server(&GlobalCtx, &CGPass);
+		return Server.serve(ServeSocket) ? 0 : 1;
+	}
 
 	return 0;
 }
@@ -10,8 +10,12 @@
 #include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
 #include "llvm/Support/CommandLine.h"
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <set>
 #include <unordered_set>
@@ -33,20 +37,52 @@ typedef std::unordered_map<llvm::Module*, llvm::StringRef> ModuleNameMap;
 typedef llvm::SmallPtrSet<llvm::Function*, 8> FuncSet;
 typedef llvm::SmallPtrSet<llvm::CallInst*, 8> CallInstSet;
 typedef DenseMap<Function*, CallInstSet> CallerMap;
-typedef DenseMap<CallInst *, FuncSet> CalleeMap;
+
+// An immutable set of functions. Equal sets are hash-consed: they share
+// one copy, which is freed with the last handle referring to it.
+class FuncSetRef {
+public:
+	typedef llvm::Function *const *iterator;
+
+	FuncSetRef() {}
+
+	// Get the shared copy of FS
+	static FuncSetRef get(const FuncSet &FS);
+
+	iterator begin() const { return Set ? Set->data() : nullptr; }
+	iterator end() const { return Set ? Set->data() + Set->size() : nullptr; }
+	size_t size() const { return Set ? Set->size() : 0; }
+	bool empty() const { return !Set; }
+	bool count(llvm::Function *F) const {
+		return std::binary_search(begin(), end(), F);
+	}
+
+	// Shared copies are unique, so equal sets share the pointer
+	bool operator==(const FuncSetRef &RHS) const { return Set == RHS.Set; }
+	bool operator!=(const FuncSetRef &RHS) const { return Set != RHS.Set; }
+
+private:
+	// Members sorted by address; null for the empty set
+	std::shared_ptr<const std::vector<llvm::Function *>> Set;
+};
+
+typedef DenseMap<CallInst *, FuncSetRef> CalleeMap;
 
 struct GlobalContext {
 
 	GlobalContext() {}
 
-	// Statistics 
-	unsigned NumFunctions = 0;
-	unsigned NumFirstLayerTypeCalls = 0;
-	unsigned NumSecondLayerTypeCalls = 0;
-	unsigned NumSecondLayerTargets = 0;
-	unsigned NumValidIndirectCalls = 0;
-	unsigned NumIndirectCallTargets = 0;
-	unsigned NumFirstLayerTargets = 0;
+	// Number of worker threads of the parallel phases
+	unsigned NumThreads = 1;
+
+	// Statistics; they may be updated by concurrent workers
+	std::atomic<unsigned> NumFunctions{0};
+	std::atomic<unsigned> NumFirstLayerTypeCalls{0};
+	std::atomic<unsigned> NumSecondLayerTypeCalls{0};
+	std::atomic<unsigned> NumSecondLayerTargets{0};
+	std::atomic<unsigned> NumValidIndirectCalls{0};
+	std::atomic<unsigned> NumIndirectCallTargets{0};
+	std::atomic<unsigned> NumFirstLayerTargets{0};
 
 	// Global variables
 	DenseMap<size_t, GlobalVariable *>Globals;
@@ -76,12 +112,59 @@ struct GlobalContext {
 
 };
 
+// Run Fn(Worker, Idx) for every Idx below NumItems on at most
+// NumThreads workers; Worker numbers the worker running the call.
+// Items are scheduled by work stealing, the heaviest first if their
+// Cost is given.
+void parallelFor(unsigned NumThreads, unsigned NumItems,
+		function_ref<void(unsigned, unsigned)> Fn,
+		function_ref<uint64_t(unsigned)> Cost = nullptr);
+
+// Load a bitcode file into a module with its own LLVMContext; NULL if
+// the file cannot be loaded
+llvm::Module *loadModule(const std::string &File);
+// Free a module loaded by loadModule() together with its context
+void releaseModule(llvm::Module *M);
+
 class IterativeModulePass {
 protected:
 	const char * ID;
+	// Number of worker threads of the parallel phases
+	unsigned NumThreads;
+
+	// ::parallelFor() on the workers of the pass
+	void parallelFor(unsigned NumItems,
+			function_ref<void(unsigned, unsigned)> Fn,
+			function_ref<uint64_t(unsigned)> Cost = nullptr) {
+		::parallelFor(NumThreads, NumItems, Fn, Cost);
+	}
+	// Same as above, where Idx indexes the module list
+	void parallelForModules(ModuleList &modules,
+			function_ref<void(unsigned, unsigned)> Fn);
+	unsigned getNumWorkers(unsigned NumItems);
+
+	// Estimated cost of analyzing a function or a module
+	static uint64_t getFunctionCost(llvm::Function *F);
+	virtual uint64_t getModuleCost(llvm::Module *M);
+	// Costs of the modules, computed once for all phases. The cost of
+	// a module must be forgotten before the module is freed.
+	DenseMap<llvm::Module *, uint64_t> ModuleCosts;
+	void computeModuleCosts(ModuleList &modules);
+	void forgetModuleCost(llvm::Module *M) { ModuleCosts.erase(M); }
+
+	// Run on all modules before iterative pass. By default, it calls
+	// doInitialization() on each module until none asks for another
+	// round.
+	virtual void initializeModules(ModuleList &modules);
+
+	// One iteration of the pass over all modules; returns the number
+	// of changed modules. By default, it calls doModulePass() on each
+	// module in turn.
+	virtual unsigned iterateModules(ModuleList &modules, unsigned iter);
+
 public:
 	IterativeModulePass(GlobalContext *Ctx_, const char *ID_)
-		: ID(ID_) { }
+		: ID(ID_), NumThreads(Ctx_->NumThreads) { }
 
 	// Run on each module before iterative pass.
 	virtual bool doInitialization(llvm::Module *M)
@@ -40,12 +40,19 @@ using namespace llvm;
 // Implementation
 //
 
-void CallGraphPass::doMLTA(Function *F) {
+// Resolve the callees of the call sites in F. It runs concurrently for
+// different functions, so it only reads the shared tables; the results
+// are recorded with recordCallees().
+void CallGraphPass::doMLTA(Function *F, vector<CallSiteTargets> &Targets) {
 
-  // Unroll loops
-#ifdef UNROLL_LOOP_ONCE
-  unrollLoops(F);
-#endif
+	// No call sites to resolve
+	if (!(getFuncFeatures(F) & FF_Call))
+		return;
+
+	// Call sites of the last run, in the same order
+	const ResolutionState::CallSite *OldCS = NULL;
+	if (Inc)
+		OldCS = Inc->OldCallSites.lookup(F);
 
   // Collect callers and callees
   for (inst_iterator i = inst_begin(F), e = inst_end(F);
@@ -53,48 +60,42 @@ void CallGraphPass::doMLTA(Function *F) {
 		// Map callsite to possible callees.
 		if (CallInst *CI = dyn_cast<CallInst>(&*i)) {
 
-			CallSet.insert(CI);
-
-			FuncSet *FS = &Ctx->Callees[CI];
+			Targets.emplace_back(CI);
+			CallSiteTargets &CT = Targets.back();
+			FuncSet *FS = &CT.FS;
+			CallDeps *Deps = Inc ? &CT.Deps : NULL;
 			Value *CV = CI->getCalledOperand();
 			Function *CF = dyn_cast<Function>(CV);
 
 			// Indirect call
 			if (CI->isIndirectCall()) {
 
+				// Targets of the last run, if not affected by changes
+				if (OldCS && reuseTargets(*OldCS, CT)) {
+					++Inc->NumReused;
+				}
 				// Multi-layer type matching
-				if (ENABLE_MLTA > 1) {
-					findCalleesWithMLTA(CI, *FS);
+				else if (ENABLE_MLTA > 1) {
+					findCalleesWithMLTA(CI, *FS, Deps);
 				}
 				// Fuzzy type matching
 				else if (ENABLE_MLTA == 0) {
 					size_t CIH = callHash(CI);
-					if (MatchedICallTypeMap.find(CIH)
-							!= MatchedICallTypeMap.end())
-						*FS = MatchedICallTypeMap[CIH];
+					FuncSetRef Matched;
+					if (MatchedICallTypeMap.lookup(CIH, Matched))
+						FS->insert(Matched.begin(), Matched.end());
 					else {
 						findCalleesWithType(CI, *FS);
-						MatchedICallTypeMap[CIH] = *FS;
+						MatchedICallTypeMap.insert(CIH, FuncSetRef::get(*FS));
 					}
 				}
 				// One-layer type matching
 				else {
-					*FS = Ctx->sigFuncsMap[callHash(CI)];
-				}
-
-#ifdef MAP_CALLER_TO_CALLEE
-				for (Function *Callee : *FS) {
-					Ctx->Callers[Callee].insert(CI);
-				}
-#endif
-				// Save called values for future uses.
-				Ctx->IndirectCallInsts.push_back(CI);
-
-				ICallSet.insert(CI);
-				if (!FS->empty()) {
-					MatchedICallSet.insert(CI);
-					Ctx->NumIndirectCallTargets += FS->size();
-					Ctx->NumValidIndirectCalls++;
+					auto SFIt = Ctx->sigFuncsMap.find(callHash(CI));
+					if (SFIt != Ctx->sigFuncsMap.end())
+						*FS = SFIt->second;
+					if (Deps)
+						Deps->Keys.push_back(hashidx_c(callHash(CI), NoIdx));
 				}
 			}
 			// Direct call
@@ -103,15 +104,12 @@ void CallGraphPass::doMLTA(Function *F) {
 				if (CF) {
 					// Call external functions
 					if (CF->isDeclaration()) {
-						if (Function *GF = Ctx->GlobalFuncMap[CF->getGUID()])
-							CF = GF;
+						auto GFIt = Ctx->GlobalFuncMap.find(CF->getGUID());
+						if (GFIt != Ctx->GlobalFuncMap.end() && GFIt->second)
+							CF = GFIt->second;
 					}
 
 					FS->insert(CF);
-
-#ifdef MAP_CALLER_TO_CALLEE
-					Ctx->Callers[CF].insert(CI);
-#endif
 				}
 				// InlineAsm
 				else {
@@ -119,48 +117,81 @@ void CallGraphPass::doMLTA(Function *F) {
 				}
 			}
 
-			if (ENABLE_MLTA > 1) {
-				if (CI->isIndirectCall()) {
+			if (OldCS)
+				++OldCS;
+		}
+	}
+}
 
-#ifdef PRINT_ICALL_TARGET
-					printSourceCodeInfo(CI, "RESOLVING");
+// Record the call sites resolved by doMLTA() in the global context
+void CallGraphPass::recordCallees(vector<CallSiteTargets> &Targets) {
+
+	for (auto &CT : Targets) {
+		CallInst *CI = CT.CI;
+		FuncSet *FS = &CT.FS;
+
+		CallSet.insert(CI);
+
+		if (CI->isIndirectCall()) {
+#ifdef MAP_CALLER_TO_CALLEE
+			for (Function *Callee : *FS) {
+				Ctx->Callers[Callee].insert(CI);
+			}
 #endif
+			// Save called values for future uses.
+			Ctx->IndirectCallInsts.push_back(CI);
+
+			ICallSet.insert(CI);
+			if (!FS->empty()) {
+				MatchedICallSet.insert(CI);
+				Ctx->NumIndirectCallTargets += FS->size();
+				Ctx->NumValidIndirectCalls++;
+			}
+
+			// Tracing the targets costs a lookup of the signature per call
+			if (ENABLE_MLTA > 1 && KA_LOG_ENABLED(LL_Debug)) {
 
-					//FuncSet FSBase = Ctx->sigFuncsMap[callHash(CI)];
-					//if (LayerNo > 0) {
-					for (auto F : Ctx->sigFuncsMap[callHash(CI)]) {
-						if (FS->find(F) == FS->end()) {
 #ifdef PRINT_ICALL_TARGET
-							if ((OutScopeFuncs.find(F) == OutScopeFuncs.end())
-									&& (StoredFuncs.find(F) != StoredFuncs.end())) {
-								printSourceCodeInfo(F, "REMOVED");
-							}
-							else {
-							}
-#endif
+				printSourceCodeInfo(CI, "RESOLVING");
+
+				auto SFIt = Ctx->sigFuncsMap.find(callHash(CI));
+				if (SFIt != Ctx->sigFuncsMap.end()) {
+					for (auto F : SFIt->second) {
+						if (FS->find(F) == FS->end()
+								&& (OutScopeFuncs.find(F) == OutScopeFuncs.end())
+								&& (StoredFuncs.find(F) != StoredFuncs.end())) {
+							printSourceCodeInfo(F, "REMOVED");
 						}
 					}
-#ifdef PRINT_ICALL_TARGET
-					printTargets(*FS, CI);
-#endif
-				}
 				}
+
+				printTargets(*FS, CI);
+#endif
 			}
 		}
+#ifdef MAP_CALLER_TO_CALLEE
+		else {
+			for (Function *Callee : *FS) {
+				Ctx->Callers[Callee].insert(CI);
+			}
+		}
+#endif
+
+		Ctx->Callees[CI] = FuncSetRef::get(*FS);
 	}
 
+	if (Inc)
+		saveCallSites(Targets);
+}
+
+// Collect module-level information needed by the type analyses of all
+// modules
 bool CallGraphPass::doInitialization(Module *M) {
 
-	OP<<"#"<<MIdx<<" Initializing: "<<M->getName()<<"\n";
+	KA_LOG(LL_Verbose)<<"#"<<MIdx<<" Initializing: "<<M->getName()<<"\n";
 
 	++ MIdx;
 
-	DLMap[M] = &(M->getDataLayout());
-	Int8PtrTy[M] = Type::getInt8PtrTy(M->getContext());
-	IntPtrTy[M] = DLMap[M]->getIntPtrType(M->getContext());
-
-	set<User *>CastSet;
-
 	//
 	// Iterate and process globals
 	//
@@ -175,79 +206,664 @@ bool CallGraphPass::doInitialization(Module *M) {
 				continue;
 
 			Ctx->Globals[GV->getGUID()] = GV;
-
-			typeConfineInInitializer(GV);
 		}
 	}
 
-	// Iterate functions and instructions
+	// Collect global function definitions.
 	for (Function &F : *M) { 
-
-		// Collect address-taken functions.
-		// NOTE: declaration functions can also have address taken 
-		if (F.hasAddressTaken()) {
-			Ctx->AddressTakenFuncs.insert(&F);
-			size_t FuncHash = funcHash(&F, false);
-			Ctx->sigFuncsMap[FuncHash].insert(&F);
-			StringRef FName = F.getName();
-      if (FName.startswith("__x64") ||
-          FName.startswith("__ia32")) {
-        OutScopeFuncs.insert(&F);
-      }
+		if (!F.isDeclaration() && F.hasExternalLinkage()) {
+			Ctx->GlobalFuncMap[F.getGUID()] = &F;
 		}
+	}
 
-		// The following only considers actual functions with body
-		if (F.isDeclaration()) {
-			continue;
-		}
+	return false;
+}
 
-		collectAliasStructPtr(&F);
-		typeConfineInFunction(&F);
-		typePropInFunction(&F);
+// Collect address-taken functions.
+void CallGraphPass::collectAddressTakenFuncs(Module *M) {
 
-		// Collect global function definitions.
-		if (F.hasExternalLinkage()) {
-			Ctx->GlobalFuncMap[F.getGUID()] = &F;
-		}
+	// NOTE: declaration functions can also have address taken 
+	for (Function &F : *M) {
+		if (F.hasAddressTaken())
+			addAddressTakenFunc(&F, funcHash(&F, false));
 	}
+}
 
-	// Do something at the end of last module
-	if (Ctx->Modules.size() == MIdx) {
+void CallGraphPass::addAddressTakenFunc(Function *F, size_t FuncHash) {
 
-		// Map the declaration functions to actual ones
-		// NOTE: to delete an item, must iterate by reference
-		for (auto &SF : Ctx->sigFuncsMap) {
-			for (auto F : SF.second) {
-				if (!F)
-					continue;
+	Ctx->AddressTakenFuncs.insert(F);
+	Ctx->sigFuncsMap[FuncHash].insert(F);
+	StringRef FName = F->getName();
+  if (FName.startswith("__x64") ||
+      FName.startswith("__ia32")) {
+    OutScopeFuncs.insert(F);
+  }
+}
+
+// Collect the alias struct pointers and the features of the functions
+// of the modules. InitFuncs receives the functions whose bodies may
+// affect the type tables.
+void CallGraphPass::collectAliasInModules(ModuleList &modules,
+		vector<vector<Function *>> &InitFuncs) {
+
+	vector<unique_ptr<MLTA>> Workers;
+	for (unsigned i = 0, e = getNumWorkers(modules.size()); i != e; ++i)
+		Workers.push_back(std::make_unique<MLTA>(this));
+
+	PhaseTimer T("CollectAlias");
+	parallelForModules(modules, [&](unsigned W, unsigned Idx) {
+		PhaseTimer MT("CollectAliasInModule", modules[Idx].second);
+		Workers[W]->collectAliasInModule(modules[Idx].first, InitFuncs[Idx]);
+	});
+	for (auto &W : Workers) {
+		mergeAliasStructPtrs(*W);
+		mergeFuncFeatures(*W);
+	}
+}
+
+// The type analyses run as a map-reduce over the modules: each worker
+// fills partial type tables for its modules, and the partial tables are
+// merged before the declaration functions are mapped to actual ones.
+void CallGraphPass::initializeModules(ModuleList &modules) {
+
+	for (auto &M : modules) {
+		PhaseTimer T("doInitialization", M.second);
+		doInitialization(M.first);
+	}
+
+	// Functions whose bodies may affect the type tables
+	vector<vector<Function *>> InitFuncs(modules.size());
+
+	// Alias struct pointers go first, as the type analyses of a
+	// function may look up the ones of another function
+	collectAliasInModules(modules, InitFuncs);
+
+	{
+		PhaseTimer T("CollectAddressTakenFuncs");
+		for (auto &M : modules)
+			collectAddressTakenFuncs(M.first);
+	}
+
+	vector<unique_ptr<MLTA>> Workers;
+	for (unsigned i = 0, e = getNumWorkers(modules.size()); i != e; ++i)
+		Workers.push_back(std::make_unique<MLTA>(this));
+
+	{
+		PhaseTimer T("TypeInit");
+		parallelForModules(modules, [&](unsigned W, unsigned Idx) {
+			PhaseTimer MT("TypeInitInModule", modules[Idx].second);
+			Workers[W]->typeInitInModule(modules[Idx].first, InitFuncs[Idx]);
+		});
+	}
+	{
+		PhaseTimer T("MergeTypeTables");
+		for (auto &W : Workers)
+			mergeTypeTables(*W);
+	}
+
+	prepareResolution();
+}
+
+// Finish the type tables for resolving call sites
+void CallGraphPass::prepareResolution() {
+
+	PhaseTimer T("PrepareResolution");
+
+	// Map the declaration functions to actual ones
+	// NOTE: to delete an item, must iterate by reference
+	for (auto &SF : Ctx->sigFuncsMap) {
+		for (auto F : SF.second) {
+			if (!F)
+				continue;
+			if (F->isDeclaration()) {
+				SF.second.erase(F);
+				if (Function *AF = Ctx->GlobalFuncMap[F->getGUID()]) {
+					SF.second.insert(AF);
+				}
+			}
+		}
+	}
+
+	for (auto &TF : typeIdxFuncsMap) {
+		for (auto &IF : TF.second) {
+			for (auto F : IF.second) {
 				if (F->isDeclaration()) {
-					SF.second.erase(F);
+					IF.second.erase(F);
 					if (Function *AF = Ctx->GlobalFuncMap[F->getGUID()]) {
-						SF.second.insert(AF);
+						IF.second.insert(AF);
 					}
 				}
 			}
 		}
+	}
 
-		for (auto &TF : typeIdxFuncsMap) {
-			for (auto &IF : TF.second) {
-				for (auto F : IF.second) {
-					if (F->isDeclaration()) {
-						IF.second.erase(F);
-						if (Function *AF = Ctx->GlobalFuncMap[F->getGUID()]) {
-							IF.second.insert(AF);
-						}
-					}
-				}
+	numberTargetFuncs();
+
+	// Precompute the dependent types of all (type, idx)s, level by level
+	vector<vector<unsigned>> PropLevels;
+	condensePropGraph(PropLevels);
+	for (auto &Level : PropLevels) {
+		parallelFor(Level.size(), [&](unsigned W, unsigned Idx) {
+			computePropClosure(Level[Idx]);
+		});
+	}
+
+	MIdx = 0;
+}
+
+// Create the stubs of the functions of S, and add S to the tables
+void CallGraphPass::installSummary(const string &Name, ModuleSummary &S,
+		vector<Function *> &Stubs) {
+
+	Module *M = new Module(Name, StubCtx);
+	StubModules.emplace_back(M);
+	M->setSourceFileName(S.SourceFileName);
+
+	FunctionType *FTy = FunctionType::get(Type::getVoidTy(StubCtx), false);
+	for (auto &Sym : S.Funcs) {
+		Function *F = Function::Create(FTy, Sym.Linkage, Sym.Name, M);
+		if (!Sym.IsDeclaration) {
+			BasicBlock *BB = BasicBlock::Create(StubCtx, Sym.EntryName, F);
+			new UnreachableInst(StubCtx, BB);
+		}
+		Stubs.push_back(F);
+
+		// As doInitialization() does
+		if (!Sym.IsDeclaration && GlobalValue::isExternalLinkage(Sym.Linkage))
+			Ctx->GlobalFuncMap[Sym.GUID] = F;
+	}
+
+	for (auto &AT : S.AddrTakenFuncs)
+		addAddressTakenFunc(Stubs[AT.second], AT.first);
+
+	for (auto &C : S.Confinements)
+		typeIdxFuncsMap[get<0>(C)][get<1>(C)].insert(Stubs[get<2>(C)]);
+	for (auto &P : S.Propagations)
+		typeIdxPropMap[get<0>(P)][get<1>(P)].insert(
+				hashidx_c(get<2>(P), get<3>(P)));
+	typeEscapeSet.insert(S.Escapes.begin(), S.Escapes.end());
+	typeCapSet.insert(S.Caps.begin(), S.Caps.end());
+	for (auto F : S.StoredFuncs)
+		StoredFuncs.insert(Stubs[F]);
+}
+
+// Confine F, which is passed to the argument of Sink, as
+// confineTargetFunction() does
+void CallGraphPass::applyArgSink(const ModuleSummary::ArgSink &Sink,
+		Function *F, size_t FuncHash) {
+
+	StoredFuncs.insert(F);
+	for (auto &TI : Sink.Chain)
+		typeIdxFuncsMap[TI.first][TI.second].insert(F);
+	if (!Sink.Complete) {
+		if (!Sink.Chain.empty())
+			typeCapSet.insert(Sink.Chain.back().first);
+		else
+			typeCapSet.insert(FuncHash);
+	}
+}
+
+// Modules are streamed three times: for the names of structs, which
+// the type hashes of all modules depend on; for the summaries of their
+// initialization; and for resolving their call sites against the
+// merged summaries, a window of modules at a time.
+void CallGraphPass::runBounded(const vector<string> &Files,
+		StringRef CacheDir, bool Incremental,
+		function_ref<void(ModuleList &)> Emit) {
+
+	OP << "[" << ID << "] Summarizing " << Files.size() << " modules\n";
+
+	unique_ptr<SummaryCache> Cache;
+	if (!CacheDir.empty())
+		Cache = std::make_unique<SummaryCache>(CacheDir);
+
+	// Summaries found in the cache need no parsing, as they also keep
+	// the structs of their modules
+	vector<ModuleSummary> Summaries(Files.size());
+	vector<string> Keys(Files.size());
+	vector<char> Loaded(Files.size(), false), Cached(Files.size(), false);
+	parallelFor(Files.size(), [&](unsigned W, unsigned Idx) {
+		PhaseTimer T("CollectStructNames", Files[Idx]);
+		ModuleSummary &S = Summaries[Idx];
+		if (Cache) {
+			Keys[Idx] = SummaryCache::getKey(Files[Idx]);
+			if (!Keys[Idx].empty() && Cache->load(Keys[Idx], S))
+				Loaded[Idx] = Cached[Idx] = true;
+		}
+		if (!Cached[Idx]) {
+			Module *M = loadModule(Files[Idx]);
+			if (!M)
+				return;
+			collectElementsStructNames(M, S.StructNames);
+			releaseModule(M);
+			Loaded[Idx] = true;
+		}
+		addElementsStructNames(S.StructNames);
+	});
+	forgetTypeHashes();
+
+	unsigned NumCached = 0;
+	for (unsigned Idx = 0; Idx < Files.size(); ++Idx) {
+		if (!Loaded[Idx])
+			KA_LOG(LL_Error) << "error loading file '" << Files[Idx] << "'\n";
+		else if (Cached[Idx] && !SummaryCache::isUpToDate(Summaries[Idx])) {
+			ModuleSummary S;
+			S.StructNames.swap(Summaries[Idx].StructNames);
+			Summaries[Idx] = std::move(S);
+			Cached[Idx] = false;
+		}
+		NumCached += Cached[Idx];
+	}
+	if (Cache)
+		OP << "[" << ID << "] " << NumCached << " summaries found in "
+			<< CacheDir << "\n";
+
+	{
+		vector<unique_ptr<MLTA>> Workers;
+		for (unsigned i = 0, e = getNumWorkers(Files.size()); i != e; ++i)
+			Workers.push_back(std::make_unique<MLTA>(Ctx));
+		parallelFor(Files.size(), [&](unsigned W, unsigned Idx) {
+			if (!Loaded[Idx] || Cached[Idx])
+				return;
+			PhaseTimer T("SummarizeModule", Files[Idx]);
+			Module *M = loadModule(Files[Idx]);
+			if (!M)
+				return;
+			Workers[W]->summarizeModule(M, Summaries[Idx]);
+			releaseModule(M);
+			if (Cache && !Keys[Idx].empty())
+				Cache->store(Keys[Idx], Summaries[Idx]);
+		});
+	}
+
+	// Install the summaries in the order doInitialization() would see
+	// the modules
+	vector<vector<Function *>> Stubs(Files.size());
+	{
+		PhaseTimer T("InstallSummaries");
+		for (unsigned Idx = 0; Idx < Files.size(); ++Idx) {
+			if (Loaded[Idx])
+				installSummary(Files[Idx], Summaries[Idx], Stubs[Idx]);
+		}
+	}
+
+	// Functions passed to declared functions are confined by the sinks
+	// of the definitions, once all definitions are known
+	DenseMap<Function *, vector<const ModuleSummary::ArgSink *>> ArgSinks;
+	for (unsigned Idx = 0; Idx < Files.size(); ++Idx) {
+		for (auto &Sink : Summaries[Idx].ArgSinks)
+			ArgSinks[Stubs[Idx][Sink.Func]].push_back(&Sink);
+	}
+	for (unsigned Idx = 0; Idx < Files.size(); ++Idx) {
+		for (auto &CA : Summaries[Idx].CallArgs) {
+			auto GI = Ctx->GlobalFuncMap.find(CA.CalleeGUID);
+			if (GI == Ctx->GlobalFuncMap.end() || !GI->second)
+				continue;
+			auto SI = ArgSinks.find(GI->second);
+			if (SI == ArgSinks.end())
+				continue;
+			for (auto Sink : SI->second) {
+				if (Sink->ArgNo == CA.ArgNo)
+					applyArgSink(*Sink, Stubs[Idx][CA.Func], CA.FuncHash);
 			}
 		}
+	}
+	ArgSinks.clear();
+
+	if (Cache && Incremental)
+		beginIncremental(*Cache, Files, Keys, Summaries, Stubs);
+	vector<ModuleSummary>().swap(Summaries);
+
+	prepareResolution();
+
+	unsigned Window = getNumWorkers(Files.size());
+	unsigned iter = 0;
+	for (unsigned Begin = 0; Begin < Files.size(); Begin += Window) {
+
+		unsigned End = std::min<unsigned>(Begin + Window, Files.size());
+		vector<Module *> WindowModules(End - Begin, NULL);
+		parallelFor(End - Begin, [&](unsigned W, unsigned Idx) {
+			if (!Loaded[Begin + Idx])
+				return;
+			PhaseTimer T("LoadModule", Files[Begin + Idx]);
+			WindowModules[Idx] = loadModule(Files[Begin + Idx]);
+		});
+
+		ModuleList modules;
+		vector<unsigned> ModuleFiles;
+		for (unsigned Idx = 0; Idx < End - Begin; ++Idx) {
+			if (WindowModules[Idx]) {
+				modules.push_back(make_pair(WindowModules[Idx],
+							StringRef(Files[Begin + Idx])));
+				ModuleFiles.push_back(Begin + Idx);
+			}
+		}
+
+		vector<vector<Function *>> InitFuncs(modules.size());
+		collectAliasInModules(modules, InitFuncs);
+		if (Inc)
+			mapOldCallSites(modules, ModuleFiles);
+		iterateModules(modules, ++iter);
+
+		Emit(modules);
+
+		Ctx->Callees.clear();
+		Ctx->Callers.clear();
+		Ctx->IndirectCallInsts.clear();
+		CallSet.clear();
+		ICallSet.clear();
+		MatchedICallSet.clear();
+		for (auto &M : modules) {
+			if (Inc) {
+				for (Function &F : *M.first)
+					Inc->FuncIDs.erase(&F);
+			}
+			forgetModule(M.first);
+			forgetModuleCost(M.first);
+			releaseModule(M.first);
+		}
+	}
+
+	if (Inc) {
+		OP << "[" << ID << "] Reused the targets of " << Inc->NumReused
+			<< " indirect calls\n";
+		Cache->storeState(Inc->New);
+	}
+
+	OP << "[" << ID << "] Done!\n\n";
+}
+
+// The call sites of the last run are reused if only the contents of
+// some files changed, and not the definitions of external functions.
+// What the changed files contribute to the type tables, before and
+// after, tells which call sites are affected.
+void CallGraphPass::beginIncremental(SummaryCache &Cache,
+		const vector<string> &Files, const vector<string> &Keys,
+		vector<ModuleSummary> &Summaries, vector<vector<Function *>> &Stubs) {
+
+	Inc = std::make_unique<IncrementalState>();
+
+	auto &New = Inc->New;
+	New.Config = "mlta=" + to_string(ENABLE_MLTA)
+		+ " budget=" + to_string(LAYER_WALK_BUDGET)
+		+ " structs=" + getElementsStructNamesDigest();
+	New.Modules.resize(Files.size());
+	Inc->FileStubs.resize(Files.size());
+	for (unsigned Idx = 0; Idx < Files.size(); ++Idx) {
+		New.Modules[Idx].File = Files[Idx];
+		New.Modules[Idx].Key = Keys[Idx];
+		for (auto F : Stubs[Idx]) {
+			Inc->StubFiles[F] = Idx;
+			// Names are unique but for unnamed functions
+			auto It = Inc->FileStubs[Idx].try_emplace(F->getName(), F);
+			if (!It.second)
+				It.first->second = NULL;
+		}
+	}
+
+	auto &Old = Inc->Old;
+	if (!Cache.loadState(Old) || Old.Config != New.Config
+			|| Old.Modules.size() != Files.size())
+		return;
+	vector<unsigned> Changed;
+	for (unsigned Idx = 0; Idx < Files.size(); ++Idx) {
+		if (Old.Modules[Idx].File != Files[Idx])
+			return;
+		if (Old.Modules[Idx].Key != Keys[Idx])
+			Changed.push_back(Idx);
+	}
+
+	vector<ModuleSummary> OldSummaries(Changed.size());
+	for (unsigned i = 0; i < Changed.size(); ++i) {
+		unsigned Idx = Changed[i];
+		const string &OldKey = Old.Modules[Idx].Key;
+		if (OldKey.empty() || Keys[Idx].empty()
+				|| !Cache.load(OldKey, OldSummaries[i]))
+			return;
+
+		// Definitions decide the targets of declarations everywhere
+		set<string> OldDefs, NewDefs;
+		for (auto &Sym : OldSummaries[i].Funcs) {
+			if (!Sym.IsDeclaration && GlobalValue::isExternalLinkage(Sym.Linkage))
+				OldDefs.insert(Sym.Name);
+		}
+		for (auto &Sym : Summaries[Idx].Funcs) {
+			if (!Sym.IsDeclaration && GlobalValue::isExternalLinkage(Sym.Linkage))
+				NewDefs.insert(Sym.Name);
+		}
+		if (OldDefs != NewDefs)
+			return;
+	}
+
+	ArgSinkMap SinksByGUID;
+	auto addSinks = [&](const ModuleSummary &S) {
+		for (auto &Sink : S.ArgSinks)
+			SinksByGUID[S.Funcs[Sink.Func].GUID].push_back(&Sink);
+	};
+	for (auto &S : Summaries)
+		addSinks(S);
+	for (auto &S : OldSummaries)
+		addSinks(S);
+	for (unsigned i = 0; i < Changed.size(); ++i)
+		addChangedKeys(OldSummaries[i], Summaries[Changed[i]], SinksByGUID);
+
+	Inc->Reusable = true;
+	OP << "[" << ID << "] " << Changed.size()
+		<< " files changed since the last run\n";
+}
+
+// Collect what S adds to the type tables, as installSummary() and
+// applyArgSink() do. Functions are referred to by name.
+void CallGraphPass::collectContributions(const ModuleSummary &S,
+		const ArgSinkMap &SinksByGUID, set<Contribution> &Contribs) {
+
+	auto add = [&](size_t TyHash, int Idx, const string &What) {
+		Contribs.insert(make_tuple(TyHash, Idx, What));
+	};
+	auto sinkName = [&](const ModuleSummary::ArgSink &Sink) {
+		string Name = to_string(Sink.ArgNo) + "," + to_string(Sink.Complete);
+		for (auto &TI : Sink.Chain)
+			Name += "," + to_string(TI.first) + ":" + to_string(TI.second);
+		return Name;
+	};
+	// A function passed to a sink is confined by the chain of it
+	auto addSink = [&](const ModuleSummary::ArgSink &Sink,
+			const string &What) {
+		for (auto &TI : Sink.Chain)
+			add(TI.first, TI.second, What);
+		if (!Sink.Complete && !Sink.Chain.empty())
+			add(Sink.Chain.back().first, NoIdx, What);
+	};
+
+	for (auto &AT : S.AddrTakenFuncs)
+		add(AT.first, NoIdx, S.Funcs[AT.second].Name);
+	for (auto &C : S.Confinements)
+		add(get<0>(C), get<1>(C), S.Funcs[get<2>(C)].Name);
+	for (auto &P : S.Propagations)
+		add(get<0>(P), get<1>(P),
+				to_string(get<2>(P)) + ":" + to_string(get<3>(P)));
+	for (auto E : S.Escapes)
+		add(E >> 32, (int)(uint32_t)E, "");
+	for (auto C : S.Caps)
+		add(C, NoIdx, "");
+
+	for (auto &Sink : S.ArgSinks)
+		addSink(Sink, S.Funcs[Sink.Func].Name + "," + sinkName(Sink));
+	for (auto &CA : S.CallArgs) {
+		string Name = S.Funcs[CA.Func].Name + "," + to_string(CA.CalleeGUID)
+			+ "," + to_string(CA.ArgNo);
+		add(CA.FuncHash, NoIdx, Name);
+		auto It = SinksByGUID.find(CA.CalleeGUID);
+		if (It == SinksByGUID.end())
+			continue;
+		for (auto Sink : It->second) {
+			if (Sink->ArgNo == CA.ArgNo)
+				addSink(*Sink, Name + "," + sinkName(*Sink));
+		}
+	}
+}
+
+// Add the keys of the type tables whose contents differ between the
+// old and new summaries of a file
+void CallGraphPass::addChangedKeys(const ModuleSummary &Old,
+		const ModuleSummary &New, const ArgSinkMap &SinksByGUID) {
+
+	set<Contribution> OldContribs, NewContribs, Changed;
+	collectContributions(Old, SinksByGUID, OldContribs);
+	collectContributions(New, SinksByGUID, NewContribs);
+	std::set_symmetric_difference(OldContribs.begin(), OldContribs.end(),
+			NewContribs.begin(), NewContribs.end(),
+			std::inserter(Changed, Changed.end()));
+
+	for (auto &C : Changed) {
+		Inc->ChangedKeys.insert(hashidx_c(get<0>(C), get<1>(C)));
+		if (get<1>(C) != NoIdx)
+			Inc->ChangedTypes.insert(get<0>(C));
+	}
+}
+
+// Find the call sites of the last run of the functions of modules,
+// whose files are Files
+void CallGraphPass::mapOldCallSites(ModuleList &modules,
+		const vector<unsigned> &Files) {
+
+	Inc->OldCallSites.clear();
+	Inc->ModuleFiles.clear();
+	for (unsigned i = 0; i < modules.size(); ++i) {
+		Module *M = modules[i].first;
+		unsigned File = Files[i];
+		Inc->ModuleFiles[M] = File;
+		if (!Inc->Reusable
+				|| Inc->Old.Modules[File].Key != Inc->New.Modules[File].Key)
+			continue;
 
-		MIdx = 0;
+		// An unchanged file has the same call sites in the same order
+		auto &CallSites = Inc->Old.Modules[File].CallSites;
+		vector<pair<Function *, size_t>> Offsets;
+		size_t NumCallSites = 0;
+		for (Function &F : *M) {
+			if (F.isDeclaration())
+				continue;
+			Offsets.push_back(make_pair(&F, NumCallSites));
+			for (Instruction &I : instructions(F)) {
+				if (isa<CallInst>(I))
+					++NumCallSites;
+			}
+		}
+		if (NumCallSites != CallSites.size())
+			continue;
+		for (auto &FO : Offsets)
+			Inc->OldCallSites[FO.first] = CallSites.data() + FO.second;
 	}
+}
+
+bool CallGraphPass::isAffected(const ResolutionState::CallSite &CS) {
 
+	for (auto &D : CS.Deps) {
+		if (D.second == AnyIdx) {
+			if (Inc->ChangedTypes.count(D.first))
+				return true;
+		}
+		else if (Inc->ChangedKeys.count(D))
+			return true;
+	}
 	return false;
 }
 
+// Take the targets of an indirect call from the last run, unless what
+// they depend on changed
+bool CallGraphPass::reuseTargets(const ResolutionState::CallSite &CS,
+		CallSiteTargets &CT) {
+
+	if (!CS.Indirect || isAffected(CS))
+		return false;
+
+	FuncSet FS;
+	for (auto T : CS.Targets) {
+		auto &OldF = Inc->Old.Funcs[T];
+		if (OldF.first >= Inc->FileStubs.size())
+			return false;
+		Function *F = Inc->FileStubs[OldF.first].lookup(OldF.second);
+		if (!F)
+			return false;
+		FS.insert(F);
+	}
+
+	CT.FS = std::move(FS);
+	CT.Deps.Keys = CS.Deps;
+	CT.Deps.Layer = CS.Layer;
+	countLayerTargets(CS.Layer, CT.FS.size());
+	return true;
+}
+
+// Save the resolved call sites in the state of this run
+void CallGraphPass::saveCallSites(vector<CallSiteTargets> &Targets) {
+
+	for (auto &CT : Targets) {
+		Function *Caller = CT.CI->getFunction();
+		unsigned File = Inc->ModuleFiles.lookup(Caller->getParent());
+
+		ResolutionState::CallSite CS;
+		CS.Caller = getStateFunc(Caller, File);
+		CS.Indirect = CT.CI->isIndirectCall();
+		CS.Layer = CT.Deps.Layer;
+		CS.Deps = std::move(CT.Deps.Keys);
+		std::sort(CS.Deps.begin(), CS.Deps.end());
+		CS.Deps.erase(std::unique(CS.Deps.begin(), CS.Deps.end()),
+				CS.Deps.end());
+		for (auto F : CT.FS)
+			CS.Targets.push_back(getStateFunc(F, File));
+		Inc->New.Modules[File].CallSites.push_back(std::move(CS));
+	}
+}
+
+// The ID of F in the state of this run. Functions that are not stubs
+// are of the module being resolved, i.e., File.
+unsigned CallGraphPass::getStateFunc(Function *F, unsigned File) {
+
+	auto It = Inc->FuncIDs.try_emplace(F, Inc->New.Funcs.size());
+	if (It.second) {
+		auto SF = Inc->StubFiles.find(F);
+		if (SF != Inc->StubFiles.end())
+			File = SF->second;
+		Inc->New.Funcs.push_back(make_pair(File, F->getName().str()));
+	}
+	return It.first->second;
+}
+
+static void collectEdges(const ResolutionState &State,
+		set<pair<string, string>> &Edges) {
+
+	for (auto &MS : State.Modules) {
+		for (auto &CS : MS.CallSites) {
+			const string &Caller = State.Funcs[CS.Caller].second;
+			for (auto T : CS.Targets) {
+				// As the call graph is dumped
+				const string &Callee = State.Funcs[T].second;
+				if (StringRef(Callee).startswith("llvm."))
+					continue;
+				Edges.insert(make_pair(Caller, Callee));
+			}
+		}
+	}
+}
+
+void CallGraphPass::getEdgeDelta(set<pair<string, string>> &Added,
+		set<pair<string, string>> &Removed) {
+
+	if (!Inc)
+		return;
+
+	set<pair<string, string>> OldEdges, NewEdges;
+	collectEdges(Inc->Old, OldEdges);
+	collectEdges(Inc->New, NewEdges);
+	std::set_difference(NewEdges.begin(), NewEdges.end(),
+			OldEdges.begin(), OldEdges.end(), std::inserter(Added, Added.end()));
+	std::set_difference(OldEdges.begin(), OldEdges.end(),
+			NewEdges.begin(), NewEdges.end(),
+			std::inserter(Removed, Removed.end()));
+}
+
 bool CallGraphPass::doFinalization(Module *M) {
 
 	++ MIdx;
@@ -267,7 +883,7 @@ bool CallGraphPass::doFinalization(Module *M) {
 				else
 					FS.insert(F);
 			}
-			Ctx->Callees[CI] = FS;
+			Ctx->Callees[CI] = FuncSetRef::get(FS);
 
 			if (CI->isIndirectCall()) {
 				Ctx->NumIndirectCallTargets += FS.size();
@@ -311,9 +927,52 @@ bool CallGraphPass::doModulePass(Module *M) {
 		if (F->isDeclaration())
 			continue;
 
-		doMLTA(F);
+		vector<CallSiteTargets> Targets;
+		doMLTA(F, Targets);
+		recordCallees(Targets);
 	}
 
 	return false;
 }
 
+// The call sites of all functions are resolved by concurrent workers,
+// and then recorded in the order of the functions, so that the results
+// do not depend on the scheduling.
+unsigned CallGraphPass::iterateModules(ModuleList &modules,
+		unsigned iter) {
+
+	vector<Function *> Funcs;
+	for (auto &M : modules) {
+		for (Function &F : *M.first) {
+			if (!F.isDeclaration())
+				Funcs.push_back(&F);
+		}
+		// Keep the module index as doModulePass() would
+		++ MIdx;
+	}
+
+	OP << "[CallGraph / " << iter << "] Resolving call sites of "
+		<< Funcs.size() << " functions\n";
+
+	vector<vector<CallSiteTargets>> Targets(Funcs.size());
+	{
+		PhaseTimer T("ResolveCallSites");
+		ProgressReporter Progress("CallGraph / " + std::to_string(iter),
+				Funcs.size());
+		parallelFor(Funcs.size(), [&](unsigned W, unsigned Idx) {
+			doMLTA(Funcs[Idx], Targets[Idx]);
+			Progress.advance();
+		}, [&](unsigned Idx) {
+			return getFunctionCost(Funcs[Idx]);
+		});
+	}
+
+	PhaseTimer T("RecordCallees");
+	for (auto &FT : Targets) {
+		recordCallees(FT);
+		vector<CallSiteTargets>().swap(FT);
+	}
+
+	return 0;
+}
+
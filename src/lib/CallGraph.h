@@ -5,6 +5,12 @@
 #include "MLTA.h"
 #include "Config.h"
 
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/LLVMContext.h"
+
+#include <atomic>
+
 class CallGraphPass : 
 	public virtual IterativeModulePass, public virtual MLTA {
 
@@ -22,10 +28,78 @@ class CallGraphPass :
 		set<CallInst *>MatchedICallSet;
 
 
+		// A call site with its possible callees
+		struct CallSiteTargets {
+			CallSiteTargets(CallInst *CI_) : CI(CI_) {}
+			CallInst *CI;
+			FuncSet FS;
+			// Only kept for incremental runs
+			CallDeps Deps;
+		};
+
+		// Stubs of the functions of summarized modules, which are not
+		// kept in memory: bodiless but for an empty entry block
+		LLVMContext StubCtx;
+		vector<unique_ptr<Module>> StubModules;
+
+		// Incremental resolution from the state of the last run
+		struct IncrementalState {
+			ResolutionState Old, New;
+			// Whether the call sites of the last run can be reused
+			bool Reusable = false;
+			// Keys with changes; a type is in ChangedTypes if any of
+			// its fields changed
+			DenseSet<hashidx_t> ChangedKeys;
+			DenseSet<size_t> ChangedTypes;
+			// Call sites of the last run of the functions being resolved
+			DenseMap<Function *, const ResolutionState::CallSite *> OldCallSites;
+			// Stubs by file and name, and the files of stubs and modules
+			vector<StringMap<Function *>> FileStubs;
+			DenseMap<Function *, unsigned> StubFiles;
+			DenseMap<Module *, unsigned> ModuleFiles;
+			// Functions of New
+			DenseMap<Function *, unsigned> FuncIDs;
+			std::atomic<unsigned> NumReused{0};
+		};
+		unique_ptr<IncrementalState> Inc;
+
+
 		//
 		// Methods
 		//
-		void doMLTA(Function *F);
+		void doMLTA(Function *F, vector<CallSiteTargets> &Targets);
+		void recordCallees(vector<CallSiteTargets> &Targets);
+		void collectAddressTakenFuncs(Module *M);
+		void addAddressTakenFunc(Function *F, size_t FuncHash);
+		void collectAliasInModules(ModuleList &modules,
+				vector<vector<Function *>> &InitFuncs);
+		void prepareResolution();
+		void installSummary(const string &Name, ModuleSummary &S,
+				vector<Function *> &Stubs);
+		void applyArgSink(const ModuleSummary::ArgSink &Sink, Function *F,
+				size_t FuncHash);
+
+		void beginIncremental(SummaryCache &Cache, const vector<string> &Files,
+				const vector<string> &Keys, vector<ModuleSummary> &Summaries,
+				vector<vector<Function *>> &Stubs);
+		typedef DenseMap<uint64_t, vector<const ModuleSummary::ArgSink *>>
+			ArgSinkMap;
+		// A key of the type tables, with what is added to it
+		typedef tuple<size_t, int, string> Contribution;
+		void collectContributions(const ModuleSummary &S,
+				const ArgSinkMap &SinksByGUID, set<Contribution> &Contribs);
+		void addChangedKeys(const ModuleSummary &Old, const ModuleSummary &New,
+				const ArgSinkMap &SinksByGUID);
+		void mapOldCallSites(ModuleList &modules, const vector<unsigned> &Files);
+		bool isAffected(const ResolutionState::CallSite &CS);
+		bool reuseTargets(const ResolutionState::CallSite &CS,
+				CallSiteTargets &CT);
+		void saveCallSites(vector<CallSiteTargets> &Targets);
+		unsigned getStateFunc(Function *F, unsigned File);
+
+	protected:
+		virtual void initializeModules(ModuleList &modules);
+		virtual unsigned iterateModules(ModuleList &modules, unsigned iter);
 
 
 	public:
@@ -43,6 +117,21 @@ class CallGraphPass :
 		virtual bool doFinalization(llvm::Module *);
 		virtual bool doModulePass(llvm::Module *);
 
+		// Build the call graph of the modules of Files with only a few
+		// of them in memory at a time. The results in Ctx are kept for
+		// one window of modules: Emit is called on each window before
+		// the modules are freed. Summaries are cached in CacheDir
+		// unless it is empty; with Incremental, so are the resolved
+		// call sites, and only the ones affected by changed files are
+		// resolved again.
+		void runBounded(const vector<string> &Files, StringRef CacheDir,
+				bool Incremental, function_ref<void(ModuleList &)> Emit);
+
+		// Edges (caller, callee) added and removed since the last run,
+		// after an incremental run
+		void getEdgeDelta(set<pair<string, string>> &Added,
+				set<pair<string, string>> &Removed);
+
 };
 
 #endif
@@ -0,0 +1,490 @@
+//===-- CallGraphFile.cc - Binary call graph files -------------===//
+//
+// The writer numbers strings, functions and call sites in sorted order,
+// so the files of the same call graph are identical. The reader checks
+// the bounds of all sections and indices once when opening a file;
+// queries then index into the mapped sections directly.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "CallGraphFile.h"
+
+using namespace llvm;
+using namespace cgfile;
+
+static const char Magic[8] = {'K', 'A', 'C', 'G', 'R', 'A', 'P', 'H'};
+
+static uint64_t alignTo8(uint64_t Off) {
+	return (Off + 7) & ~(uint64_t)7;
+}
+
+unsigned CallGraphFileWriter::addString(StringRef Str) {
+
+	auto It = StringIDs.try_emplace(Str, Strings.size());
+	if (It.second)
+		Strings.push_back(Str.str());
+	return It.first->second;
+}
+
+unsigned CallGraphFileWriter::addFunction(StringRef Name, StringRef Scope,
+		StringRef File, unsigned Line) {
+
+	unsigned NameID = addString(Name);
+	unsigned FileID = File.empty() ? NoString : addString(File);
+	auto It = FuncIDs.emplace(std::make_pair(NameID, Scope.str()),
+			Funcs.size());
+	if (It.second) {
+		Funcs.push_back({NameID, FileID, Line, Scope.str()});
+		return Funcs.size() - 1;
+	}
+
+	// Only definitions have debug info
+	Func &F = Funcs[It.first->second];
+	if (F.File == NoString) {
+		F.File = FileID;
+		F.Line = Line;
+	}
+	return It.first->second;
+}
+
+void CallGraphFileWriter::addCallSite(unsigned Caller, StringRef File,
+		unsigned Line, unsigned Column, unsigned Flags,
+		std::vector<unsigned> Targets) {
+
+	unsigned FileID = File.empty() ? NoString : addString(File);
+	Sites.push_back({Caller, FileID, Line, Column, Flags, std::move(Targets)});
+}
+
+bool CallGraphFileWriter::write(StringRef Path, std::string &Error) {
+
+	// Number strings in sorted order
+	std::vector<unsigned> Order(Strings.size());
+	std::iota(Order.begin(), Order.end(), 0);
+	std::sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+		return Strings[A] < Strings[B];
+	});
+	std::vector<unsigned> StrMap(Strings.size());
+	for (unsigned i = 0; i < Order.size(); ++i)
+		StrMap[Order[i]] = i;
+	auto mapStr = [&](unsigned ID) {
+		return ID == NoString ? NoString : StrMap[ID];
+	};
+
+	std::vector<uint32_t> StrOffs;
+	std::string StrBlob;
+	for (auto ID : Order) {
+		StrOffs.push_back(StrBlob.size());
+		StrBlob += Strings[ID];
+		StrBlob += '\0';
+	}
+	StrOffs.push_back(StrBlob.size());
+
+	// Functions by (name, file), and then by scope
+	for (auto &F : Funcs) {
+		F.Name = mapStr(F.Name);
+		F.File = mapStr(F.File);
+	}
+	Order.resize(Funcs.size());
+	std::iota(Order.begin(), Order.end(), 0);
+	std::sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+		return std::tie(Funcs[A].Name, Funcs[A].File, Funcs[A].Scope)
+			< std::tie(Funcs[B].Name, Funcs[B].File, Funcs[B].Scope);
+	});
+	std::vector<unsigned> FuncMap(Funcs.size());
+	for (unsigned i = 0; i < Order.size(); ++i)
+		FuncMap[Order[i]] = i;
+
+	// Call sites by (caller, file, line, column), and then by what
+	// tells them apart
+	for (auto &S : Sites) {
+		S.Caller = FuncMap[S.Caller];
+		S.File = mapStr(S.File);
+		for (auto &T : S.Targets)
+			T = FuncMap[T];
+		std::sort(S.Targets.begin(), S.Targets.end());
+		S.Targets.erase(std::unique(S.Targets.begin(), S.Targets.end()),
+				S.Targets.end());
+	}
+	std::sort(Sites.begin(), Sites.end(), [](const Site &A, const Site &B) {
+		return std::tie(A.Caller, A.File, A.Line, A.Column, A.Flags, A.Targets)
+			< std::tie(B.Caller, B.File, B.Line, B.Column, B.Flags, B.Targets);
+	});
+
+	unsigned NumFuncs = Funcs.size();
+	unsigned NumSites = Sites.size();
+	std::vector<std::vector<uint32_t>> Secs(NumSections);
+	for (auto ID : Order) {
+		Secs[FuncName].push_back(Funcs[ID].Name);
+		Secs[FuncFile].push_back(Funcs[ID].File);
+		Secs[FuncLine].push_back(Funcs[ID].Line);
+	}
+
+	Secs[FuncSites].assign(NumFuncs + 1, 0);
+	Secs[FuncCallers].assign(NumFuncs + 1, 0);
+	Secs[SiteTargets].push_back(0);
+	for (auto &S : Sites) {
+		++Secs[FuncSites][S.Caller + 1];
+		Secs[SiteCaller].push_back(S.Caller);
+		Secs[SiteFile].push_back(S.File);
+		Secs[SiteLine].push_back(S.Line);
+		Secs[SiteColumn].push_back(S.Column);
+		Secs[SiteFlags].push_back(S.Flags);
+		for (auto T : S.Targets) {
+			Secs[Targets].push_back(T);
+			++Secs[FuncCallers][T + 1];
+		}
+		Secs[SiteTargets].push_back(Secs[Targets].size());
+	}
+	unsigned NumEdges = Secs[Targets].size();
+	std::partial_sum(Secs[FuncSites].begin(), Secs[FuncSites].end(),
+			Secs[FuncSites].begin());
+	std::partial_sum(Secs[FuncCallers].begin(), Secs[FuncCallers].end(),
+			Secs[FuncCallers].begin());
+
+	// Callers in the order of call sites
+	Secs[CallerSites].resize(NumEdges);
+	std::vector<uint32_t> Next(Secs[FuncCallers].begin(),
+			Secs[FuncCallers].end() - 1);
+	for (unsigned S = 0; S < NumSites; ++S) {
+		for (auto T : Sites[S].Targets)
+			Secs[CallerSites][Next[T]++] = S;
+	}
+
+	Secs[SitesByLoc].resize(NumSites);
+	std::iota(Secs[SitesByLoc].begin(), Secs[SitesByLoc].end(), 0);
+	std::stable_sort(Secs[SitesByLoc].begin(), Secs[SitesByLoc].end(),
+			[&](unsigned A, unsigned B) {
+		return std::tie(Sites[A].File, Sites[A].Line, Sites[A].Column)
+			< std::tie(Sites[B].File, Sites[B].Line, Sites[B].Column);
+	});
+
+	Secs[StrOffsets] = std::move(StrOffs);
+
+	// Lay out the sections
+	Header H;
+	memset(&H, 0, sizeof(H));
+	memcpy(H.Magic, Magic, sizeof(Magic));
+	H.Version = Version;
+	H.NumStrings = Secs[StrOffsets].size() - 1;
+	H.NumFuncs = NumFuncs;
+	H.NumSites = NumSites;
+	H.NumEdges = NumEdges;
+	H.StrDataSize = StrBlob.size();
+	uint64_t Off = alignTo8(sizeof(Header));
+	for (unsigned S = 0; S < NumSections; ++S) {
+		H.Offsets[S] = Off;
+		Off = alignTo8(Off + (S == StrData ? StrBlob.size()
+					: Secs[S].size() * sizeof(uint32_t)));
+	}
+
+	SmallString<128> TmpPath;
+	int FD;
+	if (std::error_code EC =
+			sys::fs::createUniqueFile(Path + ".%%%%%%.tmp", FD, TmpPath)) {
+		Error = EC.message();
+		return false;
+	}
+
+	bool Failed;
+	{
+		raw_fd_ostream OS(FD, /*shouldClose=*/true);
+		support::endian::Writer W(OS, support::little);
+		OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+		for (unsigned S = 0; S < NumSections; ++S) {
+			OS.write_zeros(H.Offsets[S] - OS.tell());
+			if (S == StrData)
+				OS << StrBlob;
+			else
+				W.write(makeArrayRef(Secs[S]));
+		}
+		OS.write_zeros(Off - OS.tell());
+		OS.close();
+		Failed = OS.has_error();
+		if (Failed)
+			Error = OS.error().message();
+		OS.clear_error();
+	}
+	if (!Failed) {
+		if (std::error_code EC = sys::fs::rename(TmpPath, Path)) {
+			Error = EC.message();
+			Failed = true;
+		}
+	}
+	if (Failed)
+		sys::fs::remove(TmpPath);
+	return !Failed;
+}
+
+std::unique_ptr<CallGraphFile> CallGraphFile::open(StringRef Path,
+		std::string &Error) {
+
+	// Large files are mapped rather than read
+	auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+			/*RequiresNullTerminator=*/false);
+	if (!BufOrErr) {
+		Error = BufOrErr.getError().message();
+		return NULL;
+	}
+
+	std::unique_ptr<CallGraphFile> CG(new CallGraphFile());
+	CG->Buffer = std::move(*BufOrErr);
+	CG->H = reinterpret_cast<const Header *>(CG->Buffer->getBufferStart());
+	if (!CG->verify(Error))
+		return NULL;
+	return CG;
+}
+
+ArrayRef<u32> CallGraphFile::getSection(Section S) const {
+
+	const char *Start = Buffer->getBufferStart() + H->Offsets[S];
+	// Counts are widened before adding the end row, so that they do
+	// not wrap
+	uint64_t Size = 0;
+	switch (S) {
+		case StrOffsets:
+			Size = (uint64_t)H->NumStrings + 1;
+			break;
+		case StrData:
+			Size = H->StrDataSize / sizeof(uint32_t);
+			break;
+		case FuncName:
+		case FuncFile:
+		case FuncLine:
+			Size = H->NumFuncs;
+			break;
+		case FuncSites:
+		case FuncCallers:
+			Size = (uint64_t)H->NumFuncs + 1;
+			break;
+		case SiteCaller:
+		case SiteFile:
+		case SiteLine:
+		case SiteColumn:
+		case SiteFlags:
+		case SitesByLoc:
+			Size = H->NumSites;
+			break;
+		case SiteTargets:
+			Size = (uint64_t)H->NumSites + 1;
+			break;
+		case Targets:
+		case CallerSites:
+			Size = H->NumEdges;
+			break;
+		case NumSections:
+			break;
+	}
+	return makeArrayRef(reinterpret_cast<const u32 *>(Start), Size);
+}
+
+bool CallGraphFile::verify(std::string &Error) {
+
+	size_t Size = Buffer->getBufferSize();
+	if (Size < sizeof(Header) || memcmp(H->Magic, Magic, sizeof(Magic))) {
+		Error = "not a call graph file";
+		return false;
+	}
+	if (H->Version != Version) {
+		Error = "unsupported version " + std::to_string(H->Version);
+		return false;
+	}
+	// IDs are 32 bits, and NoString is not the ID of a string
+	if (H->NumStrings >= NoString || H->NumFuncs == ~0u ||
+			H->NumSites == ~0u || H->NumEdges == ~0u) {
+		Error = "malformed header";
+		return false;
+	}
+
+	for (unsigned S = 0; S < NumSections; ++S) {
+		uint64_t Off = H->Offsets[S];
+		uint64_t Bytes = S == StrData ? (uint64_t)H->StrDataSize
+			: (uint64_t)getSection((Section)S).size() * sizeof(uint32_t);
+		if (Off % 8 || Off > Size || Bytes > Size - Off) {
+			Error = "truncated or malformed sections";
+			return false;
+		}
+	}
+
+	// Offsets into other sections are in bounds and ascending
+	auto checkRows = [&](Section S, uint64_t End) {
+		auto Rows = getSection(S);
+		if (Rows.front() != 0 || Rows.back() != End)
+			return false;
+		for (unsigned i = 1; i < Rows.size(); ++i) {
+			if (Rows[i - 1] > Rows[i])
+				return false;
+		}
+		return true;
+	};
+	auto checkIDs = [&](Section S, uint64_t Num, bool Optional) {
+		for (uint32_t ID : getSection(S)) {
+			if (ID >= Num && !(Optional && ID == NoString))
+				return false;
+		}
+		return true;
+	};
+	const char *Str = Buffer->getBufferStart() + H->Offsets[StrData];
+	auto Offs = getSection(StrOffsets);
+	if (!checkRows(StrOffsets, H->StrDataSize)
+			|| !checkRows(FuncSites, H->NumSites)
+			|| !checkRows(SiteTargets, H->NumEdges)
+			|| !checkRows(FuncCallers, H->NumEdges)
+			|| !checkIDs(FuncName, H->NumStrings, false)
+			|| !checkIDs(FuncFile, H->NumStrings, true)
+			|| !checkIDs(SiteCaller, H->NumFuncs, false)
+			|| !checkIDs(SiteFile, H->NumStrings, true)
+			|| !checkIDs(Targets, H->NumFuncs, false)
+			|| !checkIDs(CallerSites, H->NumSites, false)
+			|| !checkIDs(SitesByLoc, H->NumSites, false)) {
+		Error = "malformed tables";
+		return false;
+	}
+	for (unsigned i = 1; i < Offs.size(); ++i) {
+		if (Offs[i] == Offs[i - 1] || Str[Offs[i] - 1] != '\0') {
+			Error = "malformed string table";
+			return false;
+		}
+	}
+	return true;
+}
+
+StringRef CallGraphFile::getString(unsigned ID) const {
+
+	if (ID == NoString)
+		return StringRef();
+	auto Offs = getSection(StrOffsets);
+	const char *Str = Buffer->getBufferStart() + H->Offsets[StrData];
+	return StringRef(Str + Offs[ID], Offs[ID + 1] - Offs[ID] - 1);
+}
+
+unsigned CallGraphFile::findString(StringRef Str) const {
+
+	unsigned Lo = 0, Hi = H->NumStrings;
+	while (Lo < Hi) {
+		unsigned Mid = Lo + (Hi - Lo) / 2;
+		int Cmp = getString(Mid).compare(Str);
+		if (Cmp == 0)
+			return Mid;
+		if (Cmp < 0)
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
+	}
+	return NoString;
+}
+
+StringRef CallGraphFile::getFuncName(unsigned F) const {
+	return getString(getSection(FuncName)[F]);
+}
+
+StringRef CallGraphFile::getFuncFile(unsigned F) const {
+	return getString(getSection(FuncFile)[F]);
+}
+
+unsigned CallGraphFile::getFuncLine(unsigned F) const {
+	return getSection(FuncLine)[F];
+}
+
+std::pair<unsigned, unsigned> CallGraphFile::findFunctions(
+		StringRef Name) const {
+
+	unsigned ID = findString(Name);
+	if (ID == NoString)
+		return std::make_pair(0u, 0u);
+	auto Names = getSection(FuncName);
+	auto Range = std::equal_range(Names.begin(), Names.end(), ID,
+			[](uint32_t A, uint32_t B) { return A < B; });
+	return std::make_pair(unsigned(Range.first - Names.begin()),
+			unsigned(Range.second - Names.begin()));
+}
+
+std::pair<unsigned, unsigned> CallGraphFile::getCallSites(unsigned F) const {
+
+	auto Rows = getSection(FuncSites);
+	return std::make_pair(unsigned(Rows[F]), unsigned(Rows[F + 1]));
+}
+
+CallGraphFile::IDList CallGraphFile::getCallerSites(unsigned F) const {
+
+	auto Rows = getSection(FuncCallers);
+	return getSection(CallerSites).slice(Rows[F], Rows[F + 1] - Rows[F]);
+}
+
+CallGraphFile::IDList CallGraphFile::getCallees(unsigned Site) const {
+
+	auto Rows = getSection(SiteTargets);
+	return getSection(Targets).slice(Rows[Site], Rows[Site + 1] - Rows[Site]);
+}
+
+void CallGraphFile::getFuncCallees(unsigned F,
+		std::vector<unsigned> &Callees) const {
+
+	auto Sites = getCallSites(F);
+	for (unsigned S = Sites.first; S < Sites.second; ++S) {
+		for (uint32_t T : getCallees(S))
+			Callees.push_back(T);
+	}
+	std::sort(Callees.begin(), Callees.end());
+	Callees.erase(std::unique(Callees.begin(), Callees.end()), Callees.end());
+}
+
+void CallGraphFile::getFuncCallers(unsigned F,
+		std::vector<unsigned> &Callers) const {
+
+	// Call sites are sorted by caller
+	for (uint32_t S : getCallerSites(F)) {
+		unsigned Caller = getCaller(S);
+		if (Callers.empty() || Callers.back() != Caller)
+			Callers.push_back(Caller);
+	}
+}
+
+unsigned CallGraphFile::getCaller(unsigned Site) const {
+	return getSection(SiteCaller)[Site];
+}
+
+StringRef CallGraphFile::getSiteFile(unsigned Site) const {
+	return getString(getSection(SiteFile)[Site]);
+}
+
+unsigned CallGraphFile::getSiteLine(unsigned Site) const {
+	return getSection(SiteLine)[Site];
+}
+
+unsigned CallGraphFile::getSiteColumn(unsigned Site) const {
+	return getSection(SiteColumn)[Site];
+}
+
+bool CallGraphFile::isIndirect(unsigned Site) const {
+	return getSection(SiteFlags)[Site] & SF_Indirect;
+}
+
+void CallGraphFile::findCallSites(StringRef File, unsigned Line,
+		std::vector<unsigned> &Sites) const {
+
+	unsigned FileID = findString(File);
+	if (FileID == NoString)
+		return;
+
+	auto ByLoc = getSection(SitesByLoc);
+	auto Files = getSection(SiteFile);
+	auto Lines = getSection(SiteLine);
+	auto Less = [&](uint32_t S, std::pair<unsigned, unsigned> Loc) {
+		return std::make_pair(unsigned(Files[S]), unsigned(Lines[S])) < Loc;
+	};
+	auto It = std::lower_bound(ByLoc.begin(), ByLoc.end(),
+			std::make_pair(FileID, Line), Less);
+	for (; It != ByLoc.end() && Files[*It] == FileID; ++It) {
+		if (Line && Lines[*It] != Line)
+			break;
+		Sites.push_back(*It);
+	}
+}
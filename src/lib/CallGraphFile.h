@@ -0,0 +1,163 @@
+#ifndef _CALL_GRAPH_FILE_H
+#define _CALL_GRAPH_FILE_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+// A binary call graph in compressed sparse rows, which is read by
+// mapping it into memory, without parsing.
+//
+// The file starts with a header, which is followed by the sections
+// below, all arrays of little-endian uint32_t but for the string data,
+// at 8-byte aligned offsets. Strings are sorted and NUL-terminated, so
+// comparing their IDs compares them. Functions are sorted by (name,
+// file), and call sites by (caller, file, line, column).
+//
+namespace cgfile {
+
+typedef llvm::support::ulittle32_t u32;
+typedef llvm::support::ulittle64_t u64;
+
+enum Section {
+	StrOffsets,		// [NumStrings + 1] into StrData
+	StrData,		// [StrDataSize]
+	FuncName,		// [NumFuncs] string IDs
+	FuncFile,		// [NumFuncs] string IDs
+	FuncLine,		// [NumFuncs]
+	FuncSites,		// [NumFuncs + 1] into the call sites
+	SiteCaller,		// [NumSites] function IDs
+	SiteFile,		// [NumSites] string IDs
+	SiteLine,		// [NumSites]
+	SiteColumn,		// [NumSites]
+	SiteFlags,		// [NumSites]
+	SiteTargets,	// [NumSites + 1] into Targets
+	Targets,		// [NumEdges] function IDs
+	FuncCallers,	// [NumFuncs + 1] into CallerSites
+	CallerSites,	// [NumEdges] call-site IDs
+	SitesByLoc,		// [NumSites] call-site IDs sorted by (file, line, column)
+	NumSections,
+};
+
+enum SiteFlag {
+	SF_Indirect = 1 << 0,
+};
+
+// Functions and call sites without debug info have NoString as file
+enum { NoString = ~0u };
+
+struct Header {
+	char Magic[8];
+	u32 Version;
+	u32 NumStrings;
+	u32 NumFuncs;
+	u32 NumSites;
+	u32 NumEdges;
+	u32 StrDataSize;
+	u64 Offsets[NumSections];
+};
+
+// Bump the version whenever the format changes
+const unsigned Version = 1;
+
+}
+
+//
+// Builds the file from functions and call sites added in any order
+//
+class CallGraphFileWriter {
+
+	struct Func {
+		unsigned Name, File, Line;
+		std::string Scope;
+	};
+	struct Site {
+		unsigned Caller, File, Line, Column, Flags;
+		std::vector<unsigned> Targets;
+	};
+
+	std::vector<std::string> Strings;
+	llvm::StringMap<unsigned> StringIDs;
+	std::vector<Func> Funcs;
+	std::map<std::pair<unsigned, std::string>, unsigned> FuncIDs;
+	std::vector<Site> Sites;
+
+	unsigned addString(llvm::StringRef Str);
+
+public:
+
+	// A function is identified by its name and Scope, e.g., the module
+	// of a local function. File and Line may be unknown, i.e., empty
+	// and 0, and are taken from any of the additions.
+	unsigned addFunction(llvm::StringRef Name, llvm::StringRef Scope,
+			llvm::StringRef File, unsigned Line);
+	void addCallSite(unsigned Caller, llvm::StringRef File, unsigned Line,
+			unsigned Column, unsigned Flags, std::vector<unsigned> Targets);
+
+	bool write(llvm::StringRef Path, std::string &Error);
+};
+
+//
+// Queries on a file mapped into memory. IDs are indices into the
+// function, call-site and string tables.
+//
+class CallGraphFile {
+
+	std::unique_ptr<llvm::MemoryBuffer> Buffer;
+	const cgfile::Header *H;
+
+	llvm::ArrayRef<cgfile::u32> getSection(cgfile::Section S) const;
+	bool verify(std::string &Error);
+
+public:
+
+	typedef llvm::ArrayRef<cgfile::u32> IDList;
+
+	// NULL with Error set if the file cannot be read or is malformed
+	static std::unique_ptr<CallGraphFile> open(llvm::StringRef Path,
+			std::string &Error);
+
+	unsigned getNumStrings() const { return H->NumStrings; }
+	unsigned getNumFuncs() const { return H->NumFuncs; }
+	unsigned getNumCallSites() const { return H->NumSites; }
+	unsigned getNumEdges() const { return H->NumEdges; }
+
+	llvm::StringRef getString(unsigned ID) const;
+	// ID of a string, or cgfile::NoString
+	unsigned findString(llvm::StringRef Str) const;
+
+	llvm::StringRef getFuncName(unsigned F) const;
+	llvm::StringRef getFuncFile(unsigned F) const;
+	unsigned getFuncLine(unsigned F) const;
+	// Functions of a name, as [first, last)
+	std::pair<unsigned, unsigned> findFunctions(llvm::StringRef Name) const;
+
+	// Call sites in F, as [first, last)
+	std::pair<unsigned, unsigned> getCallSites(unsigned F) const;
+	// Call sites that may call F
+	IDList getCallerSites(unsigned F) const;
+	// Possible callees of a call site
+	IDList getCallees(unsigned Site) const;
+	// Possible callees of all call sites in F, sorted and unique
+	void getFuncCallees(unsigned F, std::vector<unsigned> &Callees) const;
+	// Functions that may call F, sorted and unique
+	void getFuncCallers(unsigned F, std::vector<unsigned> &Callers) const;
+
+	unsigned getCaller(unsigned Site) const;
+	llvm::StringRef getSiteFile(unsigned Site) const;
+	unsigned getSiteLine(unsigned Site) const;
+	unsigned getSiteColumn(unsigned Site) const;
+	bool isIndirect(unsigned Site) const;
+	// Call sites at a line of a file, or at all lines if Line is 0
+	void findCallSites(llvm::StringRef File, unsigned Line,
+			std::vector<unsigned> &Sites) const;
+};
+
+#endif
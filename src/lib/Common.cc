@@ -1,14 +1,62 @@
 #include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Operator.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/MD5.h>
 #include <fstream>
 #include <regex>
 #include "Common.h"
 #include "Config.h"
 
-// Map from struct elements to its name
-static map<string, set<StringRef>>elementsStructNameMap;
+// Map from struct elements to its name. Names are copied, as modules
+// may be freed before the analysis ends.
+static map<string, set<string>>elementsStructNameMap;
+static mutex ElementsStructNameLock;
+// Entries of the map looked up by the type hashes of this thread
+static thread_local set<string> *StructNameDeps;
+
+// Canonical type strings are interned into dense IDs, which serve as
+// the hashes of types: equal strings, e.g., the same struct name in
+// different modules, get the same ID.
+static StringMap<uint32_t> TypeIDMap;
+static vector<StringRef> TypeStrings;
+static mutex TypeIDLock;
+
+uint32_t internTypeString(StringRef Str) {
+
+	lock_guard<mutex> Guard(TypeIDLock);
+	auto Res = TypeIDMap.try_emplace(Str, TypeStrings.size());
+	if (Res.second) {
+		// The largest ID is reserved, as packed keys of it would be
+		// the empty key of DenseMap
+		assert(TypeStrings.size() < UINT32_MAX);
+		TypeStrings.push_back(Res.first->getKey());
+	}
+	return Res.first->second;
+}
+
+StringRef getTypeString(uint32_t ID) {
+
+	lock_guard<mutex> Guard(TypeIDLock);
+	return TypeStrings[ID];
+}
+
+uint32_t getNumTypeIDs() {
+
+	lock_guard<mutex> Guard(TypeIDLock);
+	return TypeStrings.size();
+}
+
+// Printing types dominates hashing, so the hash of a type is computed
+// once and cached. Types live as long as their contexts, so they key
+// the caches directly; with -bounded-memory, contexts are freed along
+// with their modules, and their entries must be dropped with
+// forgetTypeHashes(C) first. The caches are shared by the workers.
+static ShardedMap<Type *, size_t> TypeHashCache;
+static ShardedMap<FunctionType *, size_t> FuncTypeHashCache;
 
 bool trimPathSlash(string &path, int slash) {
 	while (slash > 0) {
@@ -170,6 +218,9 @@ DILocation *getSourceLocation(Instruction *I) {
 
 /// Print out source code information to facilitate manual analyses.
 void printSourceCodeInfo(Value *V, string Tag) {
+  if (!KA_LOG_ENABLED(LL_Debug))
+    return;
+
   Instruction *I = dyn_cast<Instruction>(V);
   if (!I)
     return;
@@ -178,6 +229,9 @@ void printSourceCodeInfo(Value *V, string Tag) {
   if (!Loc)
     return;
 
+  KA_LOG(LL_Debug) << " [" << Tag << "] " << getSourcePath(Loc->getDirectory(),
+      Loc->getFilename()) << " +" << Loc->getLine() << "\n";
+
 //   unsigned LineNo = Loc->getLine();
 //   std::string FN = getFileName(Loc);
 //   string line = getSourceLine(FN, LineNo);
@@ -201,8 +255,18 @@ void printSourceCodeInfo(Value *V, string Tag) {
 
 
 void printSourceCodeInfo(Function *F, string Tag) {
+  if (!KA_LOG_ENABLED(LL_Debug))
+    return;
 
   DISubprogram *SP = F->getSubprogram();
+  if (SP) {
+    KA_LOG(LL_Debug) << " [" << Tag << "] " << getSourcePath(SP->getDirectory(),
+        SP->getFilename()) << " +" << SP->getLine() << "\n";
+  }
+  else {
+    KA_LOG(LL_Debug) << " [" << Tag << "] " << F->getParent()->getName()
+      << ": " << F->getName() << "\n";
+  }
 
 //   if (SP) {
 //     string FN = getFileName(NULL, SP);
@@ -291,6 +355,158 @@ void getSourceCodeInfo(Value *V, string &file,
   line = Loc->getLine();
 }
 
+bool hasCycle(Function *F) {
+
+	if (F->empty())
+		return false;
+
+	// A CFG has cycles iff a DFS from the entry finds a retreating
+	// edge. Every loop of LoopInfo is such a cycle.
+	DenseMap<BasicBlock *, bool> OnStack;
+	SmallVector<pair<BasicBlock *, succ_iterator>, 32> Stack;
+	BasicBlock *Entry = &F->getEntryBlock();
+	OnStack[Entry] = true;
+	Stack.push_back(make_pair(Entry, succ_begin(Entry)));
+	while (!Stack.empty()) {
+		BasicBlock *BB = Stack.back().first;
+		succ_iterator &SI = Stack.back().second;
+		if (SI == succ_end(BB)) {
+			OnStack[BB] = false;
+			Stack.pop_back();
+			continue;
+		}
+		BasicBlock *SuccB = *SI++;
+		auto OI = OnStack.find(SuccB);
+		if (OI != OnStack.end()) {
+			if (OI->second)
+				return true;
+			continue;
+		}
+		OnStack[SuccB] = true;
+		Stack.push_back(make_pair(SuccB, succ_begin(SuccB)));
+	}
+
+	return false;
+}
+
+// Unroll the loops as if the terminators of their latches were
+// rewritten in place. The redirections apply one after another, so
+// the view tracks the successors and predecessors they leave behind.
+UnrolledCFG::UnrolledCFG(Function *F) {
+
+	if (F->isDeclaration() || !hasCycle(F))
+		return;
+
+	for (BasicBlock &BB : *F) {
+		SuccMap[&BB].append(succ_begin(&BB), succ_end(&BB));
+		PredMap[&BB].append(pred_begin(&BB), pred_end(&BB));
+	}
+
+	DominatorTree DT(*F);
+	LoopInfo LI(DT);
+
+	// Collect all loops in the function
+	set<Loop *> LPSet;
+	for (Loop *LP : LI) {
+		LPSet.insert(LP);
+		for (Loop *SubLP : LP->getLoopsInPreorder())
+			LPSet.insert(SubLP);
+	}
+
+	for (Loop *LP : LPSet) {
+
+		// Get the header and latch blocks of every loop
+		BasicBlock *HeaderB = LP->getHeader();
+		SmallVector<BasicBlock *, 4> LatchBS;
+		for (BasicBlock *PredB : PredMap[HeaderB]) {
+			if (LP->contains(PredB))
+				LatchBS.push_back(PredB);
+		}
+
+		for (BasicBlock *LatchB : LatchBS) {
+			SmallVector<BasicBlock *, 2> Succs(SuccMap[LatchB]);
+			// Two cases:
+			// 1. Latch Block has only one successor:
+			// 	for loop or while loop;
+			// 	In this case: set the Successor of Latch Block to the 
+			//	successor block (out of loop one) of Header block
+			// 2. Latch Block has two successor: 
+			// do-while loop:
+			// In this case: set the Successor of Latch Block to the
+			//  another successor block of Latch block 
+
+			// Case 1:
+			if (Succs.size() == 1) {
+				SmallVector<BasicBlock *, 2> HeaderSuccs(SuccMap[HeaderB]);
+				for (BasicBlock *SuccB : HeaderSuccs) {
+					// Header block has two successor,
+					// one edge dominate Latch block;
+					// another does not.
+					if (dominates(DT, HeaderB, SuccB, LatchB))
+						continue;
+					redirect(LatchB, SuccB);
+				}
+			}
+			// Case 2:
+			else {
+				for (BasicBlock *SuccB : Succs) {
+					// There will be two successor blocks, one is header
+					// we need successor to be another
+					if (SuccB == HeaderB)
+						continue;
+					redirect(LatchB, SuccB);
+				}
+			}
+		}
+	}
+}
+
+void UnrolledCFG::getSuccessors(BasicBlock *BB,
+		SmallVectorImpl<BasicBlock *> &Succs) const {
+
+	auto SI = SuccMap.find(BB);
+	if (SI != SuccMap.end())
+		Succs.append(SI->second.begin(), SI->second.end());
+	else
+		Succs.append(succ_begin(BB), succ_end(BB));
+}
+
+// Set the first successor of BB. The edge moves to the front of the
+// predecessors of NewSucc, as a use does when set.
+void UnrolledCFG::redirect(BasicBlock *BB, BasicBlock *NewSucc) {
+
+	BasicBlock *&Succ = SuccMap[BB][0];
+	auto &OldPreds = PredMap[Succ];
+	OldPreds.erase(find(OldPreds, BB));
+	auto &NewPreds = PredMap[NewSucc];
+	NewPreds.insert(NewPreds.begin(), BB);
+	Succ = NewSucc;
+}
+
+// Whether the edge from Start to End dominates UseBB, as decided by
+// DominatorTree on the current successors and predecessors
+bool UnrolledCFG::dominates(DominatorTree &DT, BasicBlock *Start,
+		BasicBlock *End, BasicBlock *UseBB) {
+
+	if (!DT.dominates(End, UseBB))
+		return false;
+
+	auto &Preds = PredMap[End];
+	if (Preds.size() == 1)
+		return true;
+
+	if (count(SuccMap[Start], End) != 1)
+		return false;
+
+	for (BasicBlock *PredB : Preds) {
+		if (PredB == Start)
+			continue;
+		if (!DT.dominates(End, PredB))
+			return false;
+	}
+	return true;
+}
+
 int8_t getArgNoInCall(CallInst *CI, Value *Arg) {
 	
 	int8_t Idx = 0;
@@ -318,19 +534,81 @@ Argument *getParamByArgNo(Function *F, int8_t ArgNo) {
   return ai;
 }
 
+void collectElementsStructNames(Module *M,
+		vector<pair<string, string>> &Names) {
+
+	for (auto STy : M->getIdentifiedStructTypes()) {
+		assert(STy->hasName());
+		if (STy->isOpaque())
+			continue;
+
+		Names.push_back(make_pair(structTyStr(STy), STy->getName().str()));
+	}
+}
+
+void addElementsStructNames(const vector<pair<string, string>> &Names) {
+
+	lock_guard<mutex> Guard(ElementsStructNameLock);
+	for (auto &N : Names)
+		elementsStructNameMap[N.first].insert(N.second);
+}
+
+void getElementsStructNames(const string &Elements, vector<string> &Names) {
+
+	auto EI = elementsStructNameMap.find(Elements);
+	if (EI != elementsStructNameMap.end())
+		Names.assign(EI->second.begin(), EI->second.end());
+}
+
+string getElementsStructNamesDigest() {
+
+	MD5 Hash;
+	lock_guard<mutex> Guard(ElementsStructNameLock);
+	for (auto &EN : elementsStructNameMap) {
+		Hash.update(EN.first);
+		for (auto &Name : EN.second) {
+			Hash.update(StringRef(" ", 1));
+			Hash.update(Name);
+		}
+		Hash.update(StringRef("\n", 1));
+	}
+	MD5::MD5Result Result;
+	Hash.final(Result);
+	return Result.digest().str().str();
+}
+
+void recordStructNameDeps(set<string> *Deps) {
+	StructNameDeps = Deps;
+}
+
 void LoadElementsStructNameMap(
 		vector<pair<Module*, StringRef>> &Modules) {
 
+	PhaseTimer T("LoadElementsStructNameMap");
 	for (auto M : Modules) {
-		for (auto STy : M.first->getIdentifiedStructTypes()) {
-			assert(STy->hasName());
-			if (STy->isOpaque())
-				continue;
+		PhaseTimer MT("CollectStructNames", M.second);
+		vector<pair<string, string>> Names;
+		collectElementsStructNames(M.first, Names);
+		addElementsStructNames(Names);
+	}
 
-			string strSTy = structTyStr(STy);
-			elementsStructNameMap[strSTy].insert(STy->getName());
-		}
+	// Hashes of literal structs depend on the map
+	forgetTypeHashes();
+}
+
+void forgetTypeHashes(LLVMContext *C) {
+
+	if (!C) {
+		TypeHashCache.clear();
+		FuncTypeHashCache.clear();
+		return;
 	}
+	TypeHashCache.eraseIf([C](Type *Ty, size_t) {
+		return &Ty->getContext() == C;
+	});
+	FuncTypeHashCache.eraseIf([C](FunctionType *FTy, size_t) {
+		return &FTy->getContext() == C;
+	});
 }
 
 void cleanString(string &str) {
@@ -350,6 +628,24 @@ void cleanString(string &str) {
 	str.erase(end_pos, str.end());
 }
 
+// Hash of a function type, shared by callsites and functions
+static size_t funcTypeHash(FunctionType *FTy) {
+
+	size_t Hash;
+	if (FuncTypeHashCache.lookup(FTy, Hash))
+		return Hash;
+
+	string sig;
+	raw_string_ostream rso(sig);
+	FTy->print(rso);
+	string output = rso.str();
+	cleanString(output);
+
+	Hash = internTypeString(output);
+	FuncTypeHashCache.insert(FTy, Hash);
+	return Hash;
+}
+
 string funcTypeString(FunctionType *FTy) {
 
 	string output;
@@ -368,7 +664,6 @@ string funcTypeString(FunctionType *FTy) {
 
 size_t funcHash(Function *F, bool withName) {
 
-	hash<string> str_hash;
 	string output;
 
 #ifdef HASH_SOURCE_INFO
@@ -380,9 +675,12 @@ size_t funcHash(Function *F, bool withName) {
 	}
 	else {
 #endif
+		FunctionType *FTy = F->getFunctionType();
+		if (!withName)
+			return funcTypeHash(FTy);
+
 		string sig;
 		raw_string_ostream rso(sig);
-		FunctionType *FTy = F->getFunctionType();
 		FTy->print(rso);
 		output = rso.str();
 		//output = funcTypeString(FTy);
@@ -395,7 +693,7 @@ size_t funcHash(Function *F, bool withName) {
 	// process string
 	cleanString(output);
 
-	return str_hash(output);
+	return internTypeString(output);
 }
 
 size_t callHash(CallInst *CI) {
@@ -407,16 +705,8 @@ size_t callHash(CallInst *CI) {
 	//	if (CF)
 	//		return funcHash(CF);
 	//}
-	hash<string> str_hash;
-	string sig;
-	raw_string_ostream rso(sig);
-	FunctionType *FTy = CB->getFunctionType();
-	FTy->print(rso);
-	string strip_str = rso.str();
 	//string strip_str = funcTypeString(FTy);
-	cleanString(strip_str);
-
-	return str_hash(strip_str);
+	return funcTypeHash(CB->getFunctionType());
 }
 
 string structTyStr(StructType *STy) {
@@ -429,7 +719,6 @@ string structTyStr(StructType *STy) {
 }
 
 void structTypeHash(StructType *STy, set<size_t> &HSet) {
-  hash<string> str_hash;
   string sig;
   string ty_str;
 
@@ -437,22 +726,23 @@ void structTypeHash(StructType *STy, set<size_t> &HSet) {
   // FIXME: A few cases may not even have a name
   if (STy->hasName()) {
     ty_str = STy->getName().str();
-    HSet.insert(str_hash(ty_str));
+    HSet.insert(internTypeString(ty_str));
   }
   else {
     string sstr = structTyStr(STy);
-    if (elementsStructNameMap.find(sstr)
-        != elementsStructNameMap.end()) {
-      for (auto SStr : elementsStructNameMap[sstr]) {
-        ty_str = SStr.str();
-        HSet.insert(str_hash(ty_str));
+    if (StructNameDeps)
+      StructNameDeps->insert(sstr);
+    auto EI = elementsStructNameMap.find(sstr);
+    if (EI != elementsStructNameMap.end()) {
+      for (auto SStr : EI->second) {
+        ty_str = SStr;
+        HSet.insert(internTypeString(ty_str));
       }
     }
   }
 }
 
-size_t typeHash(Type *Ty) {
-  hash<string> str_hash;
+static size_t computeTypeHash(Type *Ty) {
   string sig;
   string ty_str;
 
@@ -464,9 +754,11 @@ size_t typeHash(Type *Ty) {
     }
     else {
       string sstr = structTyStr(STy);
-      if (elementsStructNameMap.find(sstr)
-          != elementsStructNameMap.end()) {
-        ty_str = elementsStructNameMap[sstr].begin()->str();
+      if (StructNameDeps)
+        StructNameDeps->insert(sstr);
+      auto EI = elementsStructNameMap.find(sstr);
+      if (EI != elementsStructNameMap.end()) {
+        ty_str = *EI->second.begin();
       }
     }
   }
@@ -491,12 +783,25 @@ size_t typeHash(Type *Ty) {
     string::iterator end_pos = remove(ty_str.begin(), ty_str.end(), ' ');
     ty_str.erase(end_pos, ty_str.end());
   }
-  return str_hash(ty_str);
+  return internTypeString(ty_str);
 }
 
+size_t typeHash(Type *Ty) {
+
+	size_t Hash;
+	if (TypeHashCache.lookup(Ty, Hash))
+		return Hash;
+
+	Hash = computeTypeHash(Ty);
+	TypeHashCache.insert(Ty, Hash);
+	return Hash;
+}
+
+// Pack a type ID and a field index into one key; unlike adding up
+// hashes, it never collides
 size_t hashIdxHash(size_t Hs, int Idx) {
-	hash<string> str_hash;
-	return Hs + str_hash(to_string(Idx));
+	assert(Hs <= UINT32_MAX);
+	return (Hs << 32) | (uint32_t)Idx;
 }
 
 size_t typeIdxHash(Type *Ty, int Idx) {
@@ -536,60 +841,138 @@ int64_t getGEPOffset(const Value *V, const DataLayout *DL) {
 }
 
 
-void writeMappingToJson(ostream& outFile, unordered_map<string, BBInfo> &mapping) {
-	outFile << "[\n";
-	for (auto it = mapping.begin(); it != mapping.end(); ++it) {
-		outFile << "{\n";
-		outFile << "\"name\": \"" << it->first << "\",\n";
-		outFile << "\"path\": \"" << it->second.path << "\",\n";
-		outFile << "\"lines\": [";
-		for (auto line = it->second.lines.begin(); line != it->second.lines.end(); ++line) {
-			outFile << *line;
-			if (next(line) != it->second.lines.end())
-				outFile << ", ";
-		}
-		outFile << "],\n";
-		outFile << "\"successors\": [";
-		for (auto succ = it->second.successors.begin(); succ != it->second.successors.end(); ++succ) {
-			outFile << "\"" << *succ << "\"";
-			if (next(succ) != it->second.successors.end())
-				outFile << ", ";
-		}
-		outFile << "]\n";
-		outFile << "}";
-		if (next(it) != mapping.end())
-			outFile << ",";
-		outFile << "\n";
+template <typename T>
+static void writeJsonList(raw_ostream &OS, vector<T> &List, bool Quote) {
+	std::sort(List.begin(), List.end());
+	List.erase(std::unique(List.begin(), List.end()), List.end());
+	for (auto it = List.begin(); it != List.end(); ++it) {
+		if (Quote)
+			OS << "\"" << *it << "\"";
+		else
+			OS << *it;
+		if (next(it) != List.end())
+			OS << ", ";
 	}
-	outFile << "]\n";
-}
-
-void writeICToJson(ostream& outFile, vector<ICInfo> &mapping) {
-	outFile << "[\n";
-	for (auto it = mapping.begin(); it != mapping.end(); ++it) {
-		outFile << "{\n";
-		outFile << "\"BBName\": \"" << it->BBName << "\",\n";
-		outFile << "\"path\": \"" << it->path << "\",\n";
-		outFile << "\"lines\": [";
-		for (auto line = it->lines.begin(); line != it->lines.end(); ++line) {
-			outFile << *line;
-			if (next(line) != it->lines.end())
-				outFile << ", ";
+}
+
+unsigned StringTable::intern(StringRef Str) {
+	auto Ins = IDs.try_emplace(Str, Strings.size());
+	if (Ins.second)
+		Strings.push_back(Ins.first->getKey());
+	return Ins.first->second;
+}
+
+static string joinBBName(BBName Name) {
+	return (Name.first + "&" + Name.second).str();
+}
+
+JsonRecordWriter::JsonRecordWriter(raw_ostream &OS_, bool Array_,
+		ExportStrings *Strings_) : OS(OS_), Array(Array_), Strings(Strings_) {
+	if (Array)
+		OS << "[\n";
+}
+
+void JsonRecordWriter::beginRecord() {
+	if (NumRecords++)
+		OS << ",\n";
+}
+
+void JsonRecordWriter::append(StringRef Records, unsigned Num) {
+	if (!Num)
+		return;
+	if (NumRecords)
+		OS << ",\n";
+	OS << Records;
+	NumRecords += Num;
+}
+
+// An interned name is written as [function, block]
+void JsonRecordWriter::writeName(StringRef Key, BBName Name) {
+	OS << "\"" << Key << "\": ";
+	if (Strings)
+		OS << "[" << Strings->Functions.intern(Name.first) << ", "
+			<< Strings->Blocks.intern(Name.second) << "]";
+	else
+		OS << "\"" << joinBBName(Name) << "\"";
+	OS << ",\n";
+}
+
+void JsonRecordWriter::write(BBInfo &Info) {
+	beginRecord();
+	OS << "{\n";
+	writeName("name", Info.name);
+	OS << "\"path\": ";
+	if (Strings)
+		OS << Strings->Paths.intern(Info.path) << ",\n";
+	else
+		OS << "\"" << Info.path << "\",\n";
+	OS << "\"lines\": [";
+	writeJsonList(OS, Info.lines, false);
+	OS << "],\n";
+	OS << "\"successors\": [";
+	if (Strings) {
+		// Interned in the order of the names, so the IDs do not depend
+		// on the order of the callees
+		auto &Succs = Info.successors;
+		std::sort(Succs.begin(), Succs.end());
+		Succs.erase(std::unique(Succs.begin(), Succs.end()), Succs.end());
+		for (auto it = Succs.begin(); it != Succs.end(); ++it) {
+			if (it != Succs.begin())
+				OS << ", ";
+			OS << "[" << Strings->Functions.intern(it->first) << ", "
+				<< Strings->Blocks.intern(it->second) << "]";
 		}
-		outFile << "],\n";
-		outFile << "\"callees\": [";
-		for (auto succ = it->callees.begin(); succ != it->callees.end(); ++succ) {
-			outFile << "\"" << *succ << "\"";
-			if (next(succ) != it->callees.end())
-				outFile << ", ";
+	}
+	else {
+		vector<string> Names;
+		for (auto &Succ : Info.successors)
+			Names.push_back(joinBBName(Succ));
+		writeJsonList(OS, Names, true);
+	}
+	OS << "]\n";
+	OS << "}";
+}
+
+void JsonRecordWriter::write(ICInfo &Info) {
+	beginRecord();
+	OS << "{\n";
+	writeName("BBName", Info.name);
+	OS << "\"path\": ";
+	if (Strings)
+		OS << Strings->Paths.intern(Info.path) << ",\n";
+	else
+		OS << "\"" << Info.path << "\",\n";
+	OS << "\"lines\": [";
+	writeJsonList(OS, Info.lines, false);
+	OS << "],\n";
+	OS << "\"callees\": [";
+	if (Strings) {
+		auto &Callees = Info.callees;
+		std::sort(Callees.begin(), Callees.end());
+		Callees.erase(std::unique(Callees.begin(), Callees.end()),
+				Callees.end());
+		for (auto it = Callees.begin(); it != Callees.end(); ++it) {
+			if (it != Callees.begin())
+				OS << ", ";
+			OS << Strings->Functions.intern(*it);
 		}
-		outFile << "]\n";
-		outFile << "}";
-		if (next(it) != mapping.end())
-			outFile << ",";
-		outFile << "\n";
 	}
-	outFile << "]\n";
+	else
+		writeJsonList(OS, Info.callees, true);
+	OS << "]\n";
+	OS << "}";
+}
+
+void JsonRecordWriter::finish() {
+	if (!Array)
+		return;
+	if (NumRecords)
+		OS << "\n";
+	OS << "]\n";
+}
+
+std::string getSourcePath(StringRef Dir, StringRef File) {
+	return Dir.str() + "/" + cleanPath(File.str());
 }
 
 std::string cleanPath(const std::string& path) {
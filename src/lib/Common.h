@@ -7,16 +7,25 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/IR/DebugInfo.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Support/MathExtras.h>
 
 #include <unistd.h>
 #include <bitset>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <unordered_map>
 #include <set>
 #include <vector>
 
+#include "Log.h"
+#include "Timing.h"
+
 #define Z3_ENABLED 0
 
 #if Z3_ENABLED
@@ -29,14 +38,14 @@ using namespace std;
 #define LOG(lv, stmt)							\
 	do {											\
 		if (VerboseLevel >= lv)						\
-		errs() << stmt;							\
+		KA_LOG(LL_Info) << stmt;				\
 	} while(0)
 
 
-#define OP llvm::errs()
+#define OP KA_LOG(LL_Info)
 
 #ifdef DEBUG_MLTA
-    #define DBG OP
+    #define DBG KA_LOG(LL_Debug)
 #else
     #define DBG if (false) OP
 #endif
@@ -48,8 +57,8 @@ using namespace std;
 
 #define ERR(stmt)													\
 	do {																\
-		errs() << "ERROR (" << __FUNCTION__ << "@" << __LINE__ << ")";	\
-		errs() << ": " << stmt;											\
+		KA_LOG(LL_Error) << "ERROR (" << __FUNCTION__ << "@" << __LINE__	\
+			<< "): " << stmt;											\
 		exit(-1);														\
 	} while(0)
 
@@ -63,18 +72,23 @@ using namespace std;
 #define KCYN  "\x1B[36m"  /* Cyan */
 #define KWHT  "\x1B[37m"  /* White */
 
+// Lines and names may be added in any order and with duplicates; the
+// writer sorts them. Blocks are named by their functions and their own
+// names, which are written as "function&block" but for interned outputs.
+typedef std::pair<StringRef, StringRef> BBName;
+
 struct ICInfo {
-  std::string BBName;
+  BBName name;
   std::string path;
-  std::set<int> lines;
-  std::set<std::string> callees;
+  std::vector<unsigned> lines;
+  std::vector<StringRef> callees;
 };
 
 struct BBInfo {
-	std::string name;
+	BBName name;
 	std::string path;
-	std::set<int> lines;
-	std::set<std::string> successors;
+	std::vector<unsigned> lines;
+	std::vector<BBName> successors;
 };
 
 
@@ -109,6 +123,12 @@ void getSourceCodeInfo(Value *V, string &file,
 int8_t getArgNoInCall(CallInst *CI, Value *Arg);
 Argument *getParamByArgNo(Function *F, int8_t ArgNo);
 
+// Dense IDs of canonical type strings. The hashes of types, functions
+// and callsites below are such IDs.
+uint32_t internTypeString(StringRef Str);
+StringRef getTypeString(uint32_t ID);
+uint32_t getNumTypeIDs();
+
 size_t funcHash(Function *F, bool withName = false);
 size_t callHash(CallInst *CI);
 void structTypeHash(StructType *STy, set<size_t> &HSet);
@@ -121,11 +141,62 @@ bool trimPathSlash(string &path, int slash);
 int64_t getGEPOffset(const Value *V, const DataLayout *DL);
 void LoadElementsStructNameMap(
 		vector<pair<Module*, StringRef>> &Modules);
+// Collect the (elements, name) pairs of the structs of M, and add
+// them to the map; adding is safe to do concurrently
+void collectElementsStructNames(Module *M,
+		vector<pair<string, string>> &Names);
+void addElementsStructNames(const vector<pair<string, string>> &Names);
+// Names of the structs of the elements in the map
+void getElementsStructNames(const string &Elements, vector<string> &Names);
+// Digest of the whole map
+string getElementsStructNamesDigest();
+// Record the entries of the map that type hashes computed by the
+// calling thread look up into Deps; NULL stops recording
+void recordStructNameDeps(set<string> *Deps);
+// Drop the cached hashes of the types of C, which must be done before C
+// is freed, or of all types if C is NULL
+void forgetTypeHashes(LLVMContext *C = NULL);
+
+// Strings interned in exported outputs, which refer to them by their
+// IDs. IDs are given in the order the strings are first interned.
+class StringTable {
+	StringMap<unsigned> IDs;
+	vector<StringRef> Strings;
+public:
+	unsigned intern(StringRef Str);
+	ArrayRef<StringRef> getStrings() { return Strings; }
+};
 
-void writeMappingToJson(ostream& outFile, unordered_map<string, BBInfo> &mapping);
-void writeICToJson(ostream& outFile, vector<ICInfo> &mapping);
+struct ExportStrings {
+	StringTable Paths, Functions, Blocks;
+};
+
+// Writes the records of BBMapping_later.json or ICInfo.json as a JSON
+// array, a record at a time. Without Array, only the records are
+// written, so that they can be appended to another writer. With
+// Strings, paths and names are written as the IDs they are interned as.
+class JsonRecordWriter {
+	raw_ostream &OS;
+	bool Array;
+	ExportStrings *Strings;
+	unsigned NumRecords = 0;
+	void beginRecord();
+	void writeName(StringRef Key, BBName Name);
+public:
+	JsonRecordWriter(raw_ostream &OS_, bool Array_ = true,
+			ExportStrings *Strings_ = NULL);
+	void write(BBInfo &Info);
+	void write(ICInfo &Info);
+	// Add Num records written by a writer without Array
+	void append(StringRef Records, unsigned Num);
+	unsigned getNumRecords() { return NumRecords; }
+	// Close the array
+	void finish();
+};
 
 string cleanPath(const string &path);
+// The path of a source file in debug info, as the outputs write it
+string getSourcePath(StringRef Dir, StringRef File);
 //
 // Common data structures
 //
@@ -189,6 +260,188 @@ protected:
   const uint64_t Bits = 8;
 };
 
+// A map that can be accessed by multiple threads. Keys are spread
+// over shards, each guarded by its own lock.
+template <typename KeyT, typename ValueT, unsigned NumShards = 64>
+class ShardedMap {
+public:
+  // Copy the value of Key into Val; returns false if Key is absent
+  bool lookup(const KeyT &Key, ValueT &Val) {
+    Shard &S = getShard(Key);
+    lock_guard<mutex> Guard(S.Lock);
+    auto It = S.Map.find(Key);
+    if (It == S.Map.end())
+      return false;
+    Val = It->second;
+    return true;
+  }
+
+  void insert(const KeyT &Key, const ValueT &Val) {
+    Shard &S = getShard(Key);
+    lock_guard<mutex> Guard(S.Lock);
+    S.Map[Key] = Val;
+  }
+
+  void clear() {
+    for (auto &S : Shards) {
+      lock_guard<mutex> Guard(S.Lock);
+      S.Map.clear();
+    }
+  }
+
+  // Erase the entries for which Pred(Key, Value) holds
+  template <typename PredT>
+  void eraseIf(PredT Pred) {
+    for (auto &S : Shards) {
+      lock_guard<mutex> Guard(S.Lock);
+      for (auto It = S.Map.begin(), E = S.Map.end(); It != E; ++It) {
+        if (Pred(It->first, It->second))
+          S.Map.erase(It);
+      }
+    }
+  }
+
+private:
+  struct Shard {
+    mutex Lock;
+    DenseMap<KeyT, ValueT> Map;
+  };
+  Shard Shards[NumShards];
+
+  Shard &getShard(const KeyT &Key) {
+    return Shards[DenseMapInfo<KeyT>::getHashValue(Key) % NumShards];
+  }
+};
+
+// A set of functions as a bitset over their dense IDs. Only the words
+// from the first to the last member are stored, so sets of functions
+// with close IDs stay small. Set operations work word by word.
+class FuncBitSet {
+public:
+  typedef uint64_t WordT;
+  static const unsigned WordBits = 64;
+
+  bool empty() const { return Words.empty(); }
+
+  void clear() {
+    Begin = 0;
+    Words.clear();
+  }
+
+  bool test(unsigned ID) const {
+    unsigned W = ID / WordBits;
+    if (W < Begin || W >= Begin + Words.size())
+      return false;
+    return Words[W - Begin] & ((WordT)1 << (ID % WordBits));
+  }
+
+  void insert(unsigned ID) {
+    unsigned W = ID / WordBits;
+    if (Words.empty())
+      Begin = W;
+    if (W < Begin) {
+      Words.insert(Words.begin(), Begin - W, 0);
+      Begin = W;
+    }
+    if (W >= Begin + Words.size())
+      Words.resize(W - Begin + 1, 0);
+    Words[W - Begin] |= (WordT)1 << (ID % WordBits);
+  }
+
+  FuncBitSet &operator&=(const FuncBitSet &RHS) {
+    unsigned NewBegin = std::max(Begin, RHS.Begin);
+    unsigned NewEnd = std::min(Begin + Words.size(),
+        RHS.Begin + RHS.Words.size());
+    if (NewBegin >= NewEnd) {
+      clear();
+      return *this;
+    }
+    for (unsigned W = NewBegin; W < NewEnd; ++W)
+      Words[W - NewBegin] = Words[W - Begin] & RHS.Words[W - RHS.Begin];
+    Words.resize(NewEnd - NewBegin);
+    Begin = NewBegin;
+    shrink();
+    return *this;
+  }
+
+  FuncBitSet &operator|=(const FuncBitSet &RHS) {
+    if (RHS.empty())
+      return *this;
+    if (empty()) {
+      *this = RHS;
+      return *this;
+    }
+    unsigned NewBegin = std::min(Begin, RHS.Begin);
+    unsigned NewEnd = std::max(Begin + Words.size(),
+        RHS.Begin + RHS.Words.size());
+    if (NewBegin < Begin)
+      Words.insert(Words.begin(), Begin - NewBegin, 0);
+    Words.resize(NewEnd - NewBegin, 0);
+    Begin = NewBegin;
+    for (unsigned W = 0, E = RHS.Words.size(); W < E; ++W)
+      Words[RHS.Begin - Begin + W] |= RHS.Words[W];
+    return *this;
+  }
+
+  unsigned count() const {
+    unsigned Count = 0;
+    for (WordT Word : Words)
+      Count += countPopulation(Word);
+    return Count;
+  }
+
+  // Call Fn on the ID of each member, in increasing order
+  template <typename FnT>
+  void forEach(FnT Fn) const {
+    for (unsigned W = 0, E = Words.size(); W < E; ++W) {
+      for (WordT Word = Words[W]; Word; Word &= Word - 1)
+        Fn((Begin + W) * WordBits + countTrailingZeros(Word));
+    }
+  }
+
+private:
+  // Index of the first stored word
+  unsigned Begin = 0;
+  vector<WordT> Words;
+
+  // Drop the zero words at both ends
+  void shrink() {
+    unsigned Lead = 0;
+    while (Lead < Words.size() && !Words[Lead])
+      ++Lead;
+    while (Words.size() > Lead && !Words.back())
+      Words.pop_back();
+    Words.erase(Words.begin(), Words.begin() + Lead);
+    Begin = Words.empty() ? 0 : Begin + Lead;
+  }
+};
+
+// Whether the CFG of F has cycles reachable from the entry
+bool hasCycle(Function *F);
+
+// A view of the CFG of a function with each loop unrolled once: the
+// back edges of a loop go to its exits instead. The IR itself is left
+// intact.
+class UnrolledCFG {
+public:
+  UnrolledCFG(Function *F);
+
+  // Successors of BB in the view
+  void getSuccessors(BasicBlock *BB,
+      SmallVectorImpl<BasicBlock *> &Succs) const;
+
+private:
+  // Successors and predecessors of all blocks of a function with
+  // loops; empty otherwise. The predecessors keep the order the
+  // use lists of the blocks would have.
+  DenseMap<BasicBlock *, SmallVector<BasicBlock *, 2>> SuccMap;
+  DenseMap<BasicBlock *, SmallVector<BasicBlock *, 4>> PredMap;
+
+  void redirect(BasicBlock *BB, BasicBlock *NewSucc);
+  bool dominates(DominatorTree &DT, BasicBlock *Start, BasicBlock *End,
+      BasicBlock *UseBB);
+};
+
 class Helper {
 public:
   // LLVM value
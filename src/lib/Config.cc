@@ -1,3 +1,4 @@
 #include"Config.h"
 
 int ENABLE_MLTA = 2;
+unsigned LAYER_WALK_BUDGET = 100000;
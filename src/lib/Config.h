@@ -21,6 +21,8 @@ using namespace llvm;
 //#define DEBUG_MLTA
 
 extern int ENABLE_MLTA;
+// Maximum number of values visited to find the next layer of a value
+extern unsigned LAYER_WALK_BUDGET;
 #define SOUND_MODE 1
 #define MAX_TYPE_LAYER 10
 
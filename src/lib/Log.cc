@@ -0,0 +1,115 @@
+//===-- Log.cc - Leveled and buffered logging -------------------===//
+//
+// Lines are collected in a buffer of each thread, which is written to
+// stderr under a lock, up to its last complete line.
+//
+//===-----------------------------------------------------------===//
+
+#include <chrono>
+#include <mutex>
+
+#include "Log.h"
+
+using namespace llvm;
+
+// Buffers are written out when they grow beyond this
+static const size_t LogBufferSize = 64 * 1024;
+
+static LogLevel CurLevel = LL_Info;
+static int64_t ProgressInterval = 1000;
+
+void setLogLevel(LogLevel Level) {
+	CurLevel = Level;
+}
+
+bool isLogEnabled(LogLevel Level) {
+	return Level <= CurLevel;
+}
+
+void setProgressInterval(unsigned Ms) {
+	ProgressInterval = Ms;
+}
+
+static int64_t getMilliseconds() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace {
+
+struct LogBuffer {
+	std::string Buf;
+	raw_string_ostream OS;
+
+	LogBuffer() : OS(Buf) {}
+	// What a thread logs is written out before it exits
+	~LogBuffer() { write(Buf.size()); }
+
+	void write(size_t Size) {
+		static std::mutex Lock;
+		if (!Size)
+			return;
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			errs().write(Buf.data(), Size);
+		}
+		Buf.erase(0, Size);
+	}
+
+	// Write the complete lines
+	void writeLines() {
+		size_t End = Buf.rfind('\n');
+		if (End != std::string::npos)
+			write(End + 1);
+	}
+};
+
+}
+
+static LogBuffer &getLogBuffer() {
+	thread_local LogBuffer Buffer;
+	return Buffer;
+}
+
+void flushLog() {
+	getLogBuffer().writeLines();
+}
+
+raw_ostream &LogLine::stream() {
+	return getLogBuffer().OS;
+}
+
+LogLine::~LogLine() {
+	LogBuffer &B = getLogBuffer();
+	// Errors and warnings may be the last words before exiting
+	if (Level <= LL_Warn)
+		B.write(B.Buf.size());
+	else if (B.Buf.size() >= LogBufferSize)
+		B.writeLines();
+}
+
+ProgressReporter::ProgressReporter(StringRef Title_, uint64_t Total_)
+	: Title(Title_), Total(Total_), Done(0),
+	NextReport(getMilliseconds() + ProgressInterval), Reported(0) {}
+
+ProgressReporter::~ProgressReporter() {
+	if (Total && Reported < Total)
+		report(Total);
+}
+
+void ProgressReporter::report(uint64_t N) {
+	KA_LOG(LL_Info) << "[" << Title << "] " << N << " / " << Total << "\n";
+	flushLog();
+	Reported = N;
+}
+
+void ProgressReporter::advance(uint64_t N) {
+
+	uint64_t NewDone = Done += N;
+	int64_t Now = getMilliseconds();
+	int64_t Next = NextReport;
+	// One of the threads advancing at the same time reports
+	if (Now >= Next && NextReport.compare_exchange_strong(Next,
+				Now + ProgressInterval))
+		report(NewDone);
+}
@@ -0,0 +1,86 @@
+#ifndef _KA_LOG_H
+#define _KA_LOG_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+//
+// Leveled logging to stderr. Every thread buffers what it logs and
+// writes out whole lines at a time, so the lines of threads do not
+// interleave and writes are few: when the buffer fills up, on errors
+// and warnings, on progress reports and on flushLog().
+//
+enum LogLevel {
+	LL_Error,
+	LL_Warn,
+	LL_Info,
+	// Per-module and per-iteration details
+	LL_Verbose,
+	// Compiled out unless KA_MAX_LOG_LEVEL is LL_Debug
+	LL_Debug,
+};
+
+#ifndef KA_MAX_LOG_LEVEL
+#ifdef DEBUG_MLTA
+#define KA_MAX_LOG_LEVEL LL_Debug
+#else
+#define KA_MAX_LOG_LEVEL LL_Verbose
+#endif
+#endif
+
+void setLogLevel(LogLevel Level);
+bool isLogEnabled(LogLevel Level);
+// Write out what the calling thread has logged
+void flushLog();
+
+// A statement logging at a level, which writes to the buffer of the
+// calling thread
+class LogLine {
+	LogLevel Level;
+public:
+	LogLine(LogLevel Level_) : Level(Level_) {}
+	~LogLine();
+	llvm::raw_ostream &stream();
+};
+
+#define KA_LOG_ENABLED(Level)									\
+	((Level) <= KA_MAX_LOG_LEVEL && isLogEnabled(Level))
+
+// Turns a logging statement into a void expression
+struct LogVoidify {
+	void operator&(llvm::raw_ostream &) {}
+};
+
+// KA_LOG(Level) << ...; evaluates the operands only if Level is enabled.
+// It is an expression, so that it may be the body of an if without
+// braces.
+#define KA_LOG(Level)											\
+	!KA_LOG_ENABLED(Level) ? (void)0							\
+		: LogVoidify() & LogLine(Level).stream()
+
+//
+// Reports the progress of Total steps of a phase, which may be
+// advanced by any thread, at most once per progress interval and once
+// it is done
+//
+class ProgressReporter {
+	std::string Title;
+	uint64_t Total;
+	std::atomic<uint64_t> Done;
+	std::atomic<int64_t> NextReport;
+	std::atomic<uint64_t> Reported;
+	void report(uint64_t N);
+public:
+	ProgressReporter(llvm::StringRef Title_, uint64_t Total_);
+	~ProgressReporter();
+	void advance(uint64_t N = 1);
+};
+
+// Milliseconds between the reports of a phase
+void setProgressInterval(unsigned Ms);
+
+#endif
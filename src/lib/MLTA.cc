@@ -30,11 +30,14 @@
 #include "MLTA.h"
 
 #include <map> 
+#include <mutex> 
 #include <vector> 
 
 
 using namespace llvm;
 
+static mutex StructLayoutLock;
+
 
 //
 // Implementation
@@ -68,12 +71,25 @@ bool MLTA::fuzzyTypeMatch(Type *Ty1, Type *Ty2,
 	// Make the type analysis conservative: assume general
 	// pointers, i.e., "void *" and "char *", are equivalent to 
 	// any pointer type and integer type.
+	// The types are tested in place rather than got from the
+	// contexts, which would add them to the contexts of modules other
+	// threads are working on.
+	auto IsInt8PtrTy = [M1](Type *Ty) {
+		return &Ty->getContext() == &M1->getContext() &&
+			Ty->isPointerTy() && !Ty->isOpaquePointerTy() &&
+			Ty->getPointerAddressSpace() == 0 &&
+			Ty->getPointerElementType()->isIntegerTy(8);
+	};
+	auto IsIntPtrTy = [M2](Type *Ty) {
+		return &Ty->getContext() == &M2->getContext() &&
+			Ty->isIntegerTy(M2->getDataLayout().getPointerSizeInBits());
+	};
 	if (
-			(Ty1 == Int8PtrTy[M1] &&
-			 (Ty2->isPointerTy() || Ty2 == IntPtrTy[M2])) 
+			(IsInt8PtrTy(Ty1) &&
+			 (Ty2->isPointerTy() || IsIntPtrTy(Ty2))) 
 			||
-			(Ty2 == Int8PtrTy[M1] &&
-			 (Ty1->isPointerTy() || Ty1 == IntPtrTy[M2]))
+			(IsInt8PtrTy(Ty2) &&
+			 (Ty1->isPointerTy() || IsIntPtrTy(Ty1)))
 		 )
 		return true;
 
@@ -94,10 +110,9 @@ void MLTA::findCalleesWithType(CallInst *CI, FuncSet &S) {
 	// Performance improvement: cache results for types
 	//
 	size_t CIH = callHash(CI);
-	if (MatchedFuncsMap.find(CIH) != MatchedFuncsMap.end()) {
-		if (!MatchedFuncsMap[CIH].empty())
-			S.insert(MatchedFuncsMap[CIH].begin(), 
-					MatchedFuncsMap[CIH].end());
+	FuncSetRef Matched;
+	if (MatchedFuncsMap.lookup(CIH, Matched)) {
+		S.insert(Matched.begin(), Matched.end());
 		return;
 	}
 
@@ -156,105 +171,10 @@ void MLTA::findCalleesWithType(CallInst *CI, FuncSet &S) {
 			S.insert(F);
 		}
 	}
-	MatchedFuncsMap[CIH] = S;
+	MatchedFuncsMap.insert(CIH, FuncSetRef::get(S));
 }
 
 
-void MLTA::unrollLoops(Function *F) {
-
-	if (F->isDeclaration())
-		return;
-
-	DominatorTree DT = DominatorTree();
-	DT.recalculate(*F);
-	LoopInfo *LI = new LoopInfo();
-	LI->releaseMemory();
-	LI->analyze(DT);
-
-	// Collect all loops in the function
-	set<Loop *> LPSet;
-	for (LoopInfo::iterator i = LI->begin(), e = LI->end(); i!=e; ++i) {
-
-		Loop *LP = *i;
-		LPSet.insert(LP);
-
-		list<Loop *> LPL;
-
-		LPL.push_back(LP);
-		while (!LPL.empty()) {
-			LP = LPL.front();
-			LPL.pop_front();
-			vector<Loop *> SubLPs = LP->getSubLoops();
-			for (auto SubLP : SubLPs) {
-				LPSet.insert(SubLP);
-				LPL.push_back(SubLP);
-			}
-		}
-	}
-
-	for (Loop *LP : LPSet) {
-
-		// Get the header,latch block, exiting block of every loop
-		BasicBlock *HeaderB = LP->getHeader();
-
-		unsigned NumBE = LP->getNumBackEdges();
-		SmallVector<BasicBlock *, 4> LatchBS;
-
-		LP->getLoopLatches(LatchBS);
-
-		for (BasicBlock *LatchB : LatchBS) {
-			if (!HeaderB || !LatchB) {
-				OP<<"ERROR: Cannot find Header Block or Latch Block\n";
-				continue;
-			}
-			// Two cases:
-			// 1. Latch Block has only one successor:
-			// 	for loop or while loop;
-			// 	In this case: set the Successor of Latch Block to the 
-			//	successor block (out of loop one) of Header block
-			// 2. Latch Block has two successor: 
-			// do-while loop:
-			// In this case: set the Successor of Latch Block to the
-			//  another successor block of Latch block 
-
-			// get the last instruction in the Latch block
-			Instruction *TI = LatchB->getTerminator();
-			// Case 1:
-			if (LatchB->getSingleSuccessor() != NULL) {
-				for (succ_iterator sit = succ_begin(HeaderB); 
-						sit != succ_end(HeaderB); ++sit) {  
-
-					BasicBlock *SuccB = *sit;	
-					BasicBlockEdge BBE = BasicBlockEdge(HeaderB, SuccB);
-					// Header block has two successor,
-					// one edge dominate Latch block;
-					// another does not.
-					if (DT.dominates(BBE, LatchB))
-						continue;
-					else {
-						TI->setSuccessor(0, SuccB);
-					}
-				}
-			}
-			// Case 2:
-			else {
-				for (succ_iterator sit = succ_begin(LatchB); 
-						sit != succ_end(LatchB); ++sit) {
-
-					BasicBlock *SuccB = *sit;
-					// There will be two successor blocks, one is header
-					// we need successor to be another
-					if (SuccB == HeaderB)
-						continue;
-					else{
-						TI->setSuccessor(0, SuccB);
-					}
-				}	
-			}
-		}
-	}
-}
-
 bool MLTA::isCompositeType(Type *Ty) {
 	if (Ty->isStructTy() 
 			|| Ty->isArrayTy() 
@@ -277,15 +197,223 @@ Type *MLTA::getFuncPtrType(Value *V) {
 
 Value *MLTA::recoverBaseType(Value *V) {
 	if (Instruction *I = dyn_cast<Instruction>(V)) {
-		map<Value *, Value *> &AliasMap 
-			= AliasStructPtrMap[I->getFunction()];
-		if (AliasMap.find(V) != AliasMap.end()) {
-			return AliasMap[V];
+		auto AI = SharedAliasMap->find(I->getFunction());
+		if (AI == SharedAliasMap->end())
+			return NULL;
+		map<Value *, Value *> &AliasMap = AI->second;
+		auto VI = AliasMap.find(V);
+		if (VI != AliasMap.end()) {
+			return VI->second;
 		}
 	}
 	return NULL;
 }
 
+void MLTA::collectAliasInModule(Module *M, vector<Function *> &Funcs) {
+
+	for (Function &F : *M) {
+
+		// The following only considers actual functions with body
+		if (F.isDeclaration())
+			continue;
+
+		unsigned FF = scanFuncFeatures(&F);
+		FuncFeaturesMap[&F] = FF;
+
+		// Skip bodies that cannot store, propagate or call a function
+		// pointer
+		if (!(FF & FF_TypeInit))
+			continue;
+
+		Funcs.push_back(&F);
+		collectAliasStructPtr(&F);
+	}
+}
+
+void MLTA::typeInitInModule(Module *M, vector<Function *> &Funcs) {
+
+	//
+	// Iterate and process globals
+	//
+	for (Module::global_iterator gi = M->global_begin(); 
+			gi != M->global_end(); ++gi) {
+
+		GlobalVariable* GV = &*gi;
+		if (GV->hasInitializer()) {
+
+			Type *ITy = GV->getInitializer()->getType();
+			if (!ITy->isPointerTy() && !isCompositeType(ITy))
+				continue;
+
+			typeConfineInInitializer(GV);
+		}
+	}
+
+	// Confinement and propagation in one sweep over each function
+	static const vector<InstHandler> Handlers = {
+		{IK_Store, &MLTA::confineInStore},
+		{IK_Call, &MLTA::confineInCall},
+		{IK_Store | IK_Call, &MLTA::propagateInStore},
+	};
+	for (Function *F : Funcs)
+		visitInstructions(F, Handlers);
+
+	// Values of the module are not looked up again
+	BaseTypeChainMap.clear();
+}
+
+void MLTA::summarizeModule(Module *M, ModuleSummary &S) {
+
+	// The hashes of literal structs depend on the names in all modules
+	set<string> StructNameDeps;
+	recordStructNameDeps(&StructNameDeps);
+
+	vector<Function *> Funcs;
+	vector<CallArgConfinement> CallArgs;
+	collectAliasInModule(M, Funcs);
+	DeferredCallArgs = &CallArgs;
+	typeInitInModule(M, Funcs);
+	DeferredCallArgs = NULL;
+
+	S.SourceFileName = M->getSourceFileName();
+
+	DenseMap<Function *, unsigned> FuncSyms;
+	auto getSym = [&](Function *F) {
+		auto It = FuncSyms.try_emplace(F, S.Funcs.size());
+		if (It.second) {
+			ModuleSummary::FuncSym Sym;
+			Sym.Name = F->getName().str();
+			Sym.GUID = F->getGUID();
+			Sym.Linkage = F->getLinkage();
+			Sym.IsDeclaration = F->isDeclaration();
+			if (!F->empty())
+				Sym.EntryName = F->getEntryBlock().getName().str();
+			S.Funcs.push_back(std::move(Sym));
+		}
+		return It.first->second;
+	};
+
+	for (Function &F : *M) {
+		if (F.hasAddressTaken())
+			S.AddrTakenFuncs.push_back(
+					make_pair(funcHash(&F, false), getSym(&F)));
+
+		// Definitions that calls in other modules may be mapped to
+		if (F.isDeclaration() || !F.hasExternalLinkage())
+			continue;
+		unsigned Sym = getSym(&F);
+		for (Argument &Arg : F.args()) {
+			// Beyond what getParamByArgNo() can find
+			if (Arg.getArgNo() > INT8_MAX)
+				break;
+			for (auto U : Arg.users()) {
+				if (!isa<StoreInst>(U) && !isa<BitCastOperator>(U))
+					continue;
+				const BaseTypeChain &BTC = lookupBaseTypeChain(U);
+				ModuleSummary::ArgSink Sink;
+				Sink.Func = Sym;
+				Sink.ArgNo = Arg.getArgNo();
+				for (auto &TI : BTC.Chain)
+					Sink.Chain.push_back(make_pair(typeHash(TI.first), TI.second));
+				Sink.Complete = BTC.Complete;
+				S.ArgSinks.push_back(std::move(Sink));
+			}
+		}
+	}
+
+	for (auto &CA : CallArgs) {
+		S.CallArgs.push_back({getSym(CA.F), funcHash(CA.F, false),
+				CA.CalleeGUID, CA.ArgNo});
+	}
+
+	for (auto &TF : typeIdxFuncsMap) {
+		for (auto &IF : TF.second) {
+			for (auto F : IF.second)
+				S.Confinements.push_back(
+						make_tuple(TF.first, IF.first, getSym(F)));
+		}
+	}
+	for (auto &TP : typeIdxPropMap) {
+		for (auto &IP : TP.second) {
+			for (auto &From : IP.second)
+				S.Propagations.push_back(
+						make_tuple(TP.first, IP.first, From.first, From.second));
+		}
+	}
+	S.Escapes.assign(typeEscapeSet.begin(), typeEscapeSet.end());
+	S.Caps.assign(typeCapSet.begin(), typeCapSet.end());
+	for (auto F : StoredFuncs)
+		S.StoredFuncs.push_back(getSym(F));
+
+	recordStructNameDeps(NULL);
+	for (auto &Elements : StructNameDeps) {
+		S.StructNameDeps.emplace_back(Elements, vector<string>());
+		getElementsStructNames(Elements, S.StructNameDeps.back().second);
+	}
+
+	typeIdxFuncsMap.clear();
+	typeIdxPropMap.clear();
+	typeEscapeSet.clear();
+	typeCapSet.clear();
+	StoredFuncs.clear();
+	VTableFuncsMap.clear();
+	BaseTypeChainMap.clear();
+	forgetModule(M);
+}
+
+void MLTA::forgetModule(Module *M) {
+
+	for (Function &F : *M) {
+		AliasStructPtrMap.erase(&F);
+		FuncFeaturesMap.erase(&F);
+	}
+}
+
+void MLTA::mergeAliasStructPtrs(MLTA &W) {
+
+	for (auto &AM : W.AliasStructPtrMap) {
+		if (!AM.second.empty())
+			AliasStructPtrMap[AM.first] = std::move(AM.second);
+	}
+	W.AliasStructPtrMap.clear();
+}
+
+void MLTA::mergeFuncFeatures(MLTA &W) {
+
+	FuncFeaturesMap.insert(W.FuncFeaturesMap.begin(),
+			W.FuncFeaturesMap.end());
+	W.FuncFeaturesMap.clear();
+}
+
+void MLTA::mergeTypeTables(MLTA &W) {
+
+	for (auto &TF : W.typeIdxFuncsMap) {
+		for (auto &IF : TF.second) {
+			typeIdxFuncsMap[TF.first][IF.first].insert(
+					IF.second.begin(), IF.second.end());
+		}
+	}
+	for (auto &TP : W.typeIdxPropMap) {
+		for (auto &IP : TP.second) {
+			typeIdxPropMap[TP.first][IP.first].insert(
+					IP.second.begin(), IP.second.end());
+		}
+	}
+	typeEscapeSet.insert(W.typeEscapeSet.begin(), W.typeEscapeSet.end());
+	typeCapSet.insert(W.typeCapSet.begin(), W.typeCapSet.end());
+	StoredFuncs.insert(W.StoredFuncs.begin(), W.StoredFuncs.end());
+	for (auto &VF : W.VTableFuncsMap) {
+		VTableFuncsMap[VF.first].insert(VF.second.begin(), VF.second.end());
+	}
+
+	W.typeIdxFuncsMap.clear();
+	W.typeIdxPropMap.clear();
+	W.typeEscapeSet.clear();
+	W.typeCapSet.clear();
+	W.StoredFuncs.clear();
+	W.VTableFuncsMap.clear();
+}
+
 // This function analyzes globals to collect information about which
 // types functions have been assigned to.
 // The analysis is field sensitive.
@@ -449,174 +577,158 @@ bool MLTA::typeConfineInInitializer(GlobalVariable *GV) {
 // This function analyzes instructions to collect information about
 // which types functions have been assigned to.
 // The analysis is field sensitive.
-bool MLTA::typeConfineInFunction(Function *F) {
+// Sweep over the instructions of F once, and dispatch each to the
+// handlers of its kind
+void MLTA::visitInstructions(Function *F,
+		const vector<InstHandler> &Handlers) {
 
 	for (inst_iterator i = inst_begin(F), e = inst_end(F); 
 			i != e; ++i) {
 
 		Instruction *I = &*i;
 
-		if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
-			Value *PO = SI->getPointerOperand();
-			Value *VO = SI->getValueOperand();
-
-			Function *CF = getBaseFunction(VO->stripPointerCasts());
-			if (!CF) 
-				continue;
-			if (F->isIntrinsic())
-				continue;
+		unsigned Kind = 0;
+		if (isa<StoreInst>(I))
+			Kind = IK_Store;
+		else if (isa<CallInst>(I))
+			Kind = IK_Call;
+		else
+			continue;
 
-			confineTargetFunction(PO, CF);
-		}
-		else if (CallInst *CI = dyn_cast<CallInst>(I)) {
-			for (User::op_iterator OI = I->op_begin(), 
-					OE = I->op_end();
-					OI != OE; ++OI) {
-				if (Function *F = dyn_cast<Function>(*OI)) {
-					if (F->isIntrinsic())
-						continue;
-					if (CI->isIndirectCall()) {
-						confineTargetFunction(*OI, F);
-						continue;
-					}
-					Value *CV = CI->getCalledOperand();
-					Function *CF = dyn_cast<Function>(CV);
-					if (!CF)
-						continue;
-					if (CF->isDeclaration())
-						CF = Ctx->GlobalFuncMap[CF->getGUID()];
-					if (!CF)
-						continue;
-					if (Argument *Arg = getParamByArgNo(CF, OI->getOperandNo())) {
-						for (auto U : Arg->users()) {
-							if (isa<StoreInst>(U) || isa<BitCastOperator>(U)) {
-								confineTargetFunction(U, F);
-							}
-						}
-					}
-					// TODO: track into the callee to avoid marking the
-					// function type as a cap
-				}
-			}
+		for (auto &H : Handlers) {
+			if (H.Kinds & Kind)
+				(this->*H.Fn)(I);
 		}
 	}
-
-	return true;
 }
 
-bool MLTA::typePropInFunction(Function *F) {
+// Confine a function stored to memory
+void MLTA::confineInStore(Instruction *I) {
 
-	// Two cases for propagation: store and cast. 
-	// For store, LLVM may use memcpy
-	set<User *>CastSet;
-	for (inst_iterator i = inst_begin(F), e = inst_end(F); 
-			i != e; ++i) {
+	StoreInst *SI = cast<StoreInst>(I);
+	Value *PO = SI->getPointerOperand();
+	Value *VO = SI->getValueOperand();
 
-		Instruction *I = &*i;
+	Function *CF = getBaseFunction(VO->stripPointerCasts());
+	if (!CF) 
+		return;
+	if (I->getFunction()->isIntrinsic())
+		return;
 
-		Value *PO = NULL, *VO = NULL;
-		if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
-			PO = SI->getPointerOperand();
-			VO = SI->getValueOperand();
-		}
-		else if (CallInst *CI = dyn_cast<CallInst>(I)) {
-			Value *CV = CI->getCalledOperand();
-			Function *CF = dyn_cast<Function>(CV);
-			if (CF) {
-				// LLVM may optimize struct assignment into a call to
-				// intrinsic memcpy
-				if (CF->getName() == "llvm.memcpy.p0i8.p0i8.i64") {
-					PO = CI->getOperand(0);
-					VO = CI->getOperand(1);
-				}
-			}
-		}
+	confineTargetFunction(PO, CF);
+}
 
-		if (PO && VO) {
-			//
-			// TODO: if VO is a global with an initializer, this should be
-			// taken as a confinement instead of propagation, which can
-			// improve the precision
-			//
-			if (isa<ConstantAggregate>(VO) || isa<ConstantData>(VO))
-				continue;
+// Confine a function passed as an argument
+void MLTA::confineInCall(Instruction *I) {
 
-			list<typeidx_t>TyList;
-			Value *NextV = NULL;
-			set<Value *> Visited;
-			nextLayerBaseType(VO, TyList, NextV, Visited);
-			if (!TyList.empty()) {
-				for (auto TyIdx : TyList) {
-					propagateType(PO, TyIdx.first, TyIdx.second);
-				}
+	CallInst *CI = cast<CallInst>(I);
+	for (User::op_iterator OI = I->op_begin(), 
+			OE = I->op_end();
+			OI != OE; ++OI) {
+		if (Function *F = dyn_cast<Function>(*OI)) {
+			if (F->isIntrinsic())
+				continue;
+			if (CI->isIndirectCall()) {
+				confineTargetFunction(*OI, F);
 				continue;
 			}
-
-			Visited.clear();
-			Type *BTy = getBaseType(VO, Visited);
-			// Composite type
-			if (BTy) {
-				propagateType(PO, BTy);
+			Value *CV = CI->getCalledOperand();
+			Function *CF = dyn_cast<Function>(CV);
+			if (!CF)
+				continue;
+			if (CF->isDeclaration() && DeferredCallArgs) {
+				DeferredCallArgs->push_back(
+						{F, CF->getGUID(), (int8_t)OI->getOperandNo()});
 				continue;
 			}
-			
-			Type *FTy = getFuncPtrType(VO->stripPointerCasts());
-			// Function-pointer type
-			if (FTy) {
-				if (!getBaseFunction(VO)) {
-					propagateType(PO, FTy);
-					continue;
-				}
-				else
-					continue;
+			if (CF->isDeclaration()) {
+				auto GI = Ctx->GlobalFuncMap.find(CF->getGUID());
+				CF = (GI != Ctx->GlobalFuncMap.end()) ? GI->second : NULL;
 			}
-			
-			if (!VO->getType()->isPointerTy())
+			if (!CF)
 				continue;
-			else {
-				// General-pointer type for escaping
-				escapeType(PO);
+			if (Argument *Arg = getParamByArgNo(CF, OI->getOperandNo())) {
+				for (auto U : Arg->users()) {
+					if (isa<StoreInst>(U) || isa<BitCastOperator>(U)) {
+						confineTargetFunction(U, F);
+					}
+				}
 			}
+			// TODO: track into the callee to avoid marking the
+			// function type as a cap
+		}
+	}
+}
 
+// Propagate types with a store. LLVM may use memcpy for it.
+void MLTA::propagateInStore(Instruction *I) {
+
+	Value *PO = NULL, *VO = NULL;
+	if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+		PO = SI->getPointerOperand();
+		VO = SI->getValueOperand();
+	}
+	else if (CallInst *CI = dyn_cast<CallInst>(I)) {
+		Value *CV = CI->getCalledOperand();
+		Function *CF = dyn_cast<Function>(CV);
+		if (CF) {
+			// LLVM may optimize struct assignment into a call to
+			// intrinsic memcpy
+			if (CF->getName() == "llvm.memcpy.p0i8.p0i8.i64") {
+				PO = CI->getOperand(0);
+				VO = CI->getOperand(1);
+			}
 		}
+	}
 
+	if (!PO || !VO)
+		return;
 
-		// Handle casts
-		if (CastInst *CastI = dyn_cast<CastInst>(I)) {
-			// Record the cast, handle later
-			CastSet.insert(CastI);
-		}
+	//
+	// TODO: if VO is a global with an initializer, this should be
+	// taken as a confinement instead of propagation, which can
+	// improve the precision
+	//
+	if (isa<ConstantAggregate>(VO) || isa<ConstantData>(VO))
+		return;
 
-		// Operands of instructions can be BitCastOperator
-		for (User::op_iterator OI = I->op_begin(), 
-				OE = I->op_end();
-				OI != OE; ++OI) {
-			if (BitCastOperator *CO = dyn_cast<BitCastOperator>(*OI)) {
-				CastSet.insert(CO);
-			}
+	list<typeidx_t>TyList;
+	Value *NextV = NULL;
+	set<Value *> Visited;
+	nextLayerBaseType(VO, TyList, NextV, Visited);
+	if (!TyList.empty()) {
+		for (auto TyIdx : TyList) {
+			propagateType(PO, TyIdx.first, TyIdx.second);
 		}
+		return;
 	}
 
-	for (auto Cast : CastSet) {
-		
-		// TODO: we may not need to handle casts as casts are already
-		// stripped out in confinement and propagation analysis. Also for
-		// a function pointer to propagate, it is supposed to be stored
-		// in memory.
-
-		// The conservative escaping policy can be optimized
-		Type *FromTy = Cast->getOperand(0)->getType();
-		Type *ToTy = Cast->getType();
-		if (FromTy->isPointerTy() && ToTy->isPointerTy()) {
-			Type *EFromTy = FromTy->getPointerElementType();
-			Type *EToTy = ToTy->getPointerElementType();
-			if (EFromTy->isStructTy() && EToTy->isStructTy()) {
-				//propagateType(Cast, EFromTy, -1);
-			}
-		}
+	Visited.clear();
+	Type *BTy = getBaseType(VO, Visited);
+	// Composite type
+	if (BTy) {
+		propagateType(PO, BTy);
+		return;
 	}
 
-	return true;
+	Type *FTy = getFuncPtrType(VO->stripPointerCasts());
+	// Function-pointer type
+	if (FTy) {
+		if (!getBaseFunction(VO))
+			propagateType(PO, FTy);
+		return;
+	}
+
+	if (!VO->getType()->isPointerTy())
+		return;
+	else {
+		// General-pointer type for escaping
+		escapeType(PO);
+	}
+
+	// TODO: casts are not handled, as they are already stripped out
+	// in confinement and propagation analysis. Also for a function
+	// pointer to propagate, it is supposed to be stored in memory.
 }
 
 // This function precisely collect alias types for general pointers
@@ -637,7 +749,7 @@ void MLTA::collectAliasStructPtr(Function *F) {
 
 			Type *FromTy = FromV->getType();
 			Type *ToTy = CI->getType();
-			if (Int8PtrTy[F->getParent()] != FromTy)
+			if (Type::getInt8PtrTy(F->getContext()) != FromTy)
 				continue;
 
 			if (!ToTy->isPointerTy())
@@ -657,6 +769,53 @@ void MLTA::collectAliasStructPtr(Function *F) {
 		AliasMap.erase(Erase);
 }
 
+// Scan the body of F for the features the phases act on. The
+// initialization analyses only act on stores, memcpy, casts of call
+// results and calls that take function addresses as arguments.
+unsigned MLTA::scanFuncFeatures(Function *F) {
+
+	unsigned FF = 0;
+	for (inst_iterator i = inst_begin(F), e = inst_end(F); 
+			i != e; ++i) {
+
+		Instruction *I = &*i;
+
+		if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+			// Function addresses are neither aggregates nor data
+			Value *VO = SI->getValueOperand();
+			if (!isa<ConstantAggregate>(VO) && !isa<ConstantData>(VO))
+				FF |= FF_Store;
+		}
+		else if (CallInst *CI = dyn_cast<CallInst>(I)) {
+			FF |= FF_Call;
+			if (CI->isIndirectCall())
+				FF |= FF_ICall;
+			Value *CV = CI->getCalledOperand();
+			Function *CF = dyn_cast<Function>(CV);
+			if (CF && CF->getName() == "llvm.memcpy.p0i8.p0i8.i64")
+				FF |= FF_Memcpy;
+			for (Value *O : CI->operands()) {
+				if (O != CV && isa<Function>(O))
+					FF |= FF_FuncArg;
+			}
+		}
+		else if (CastInst *CastI = dyn_cast<CastInst>(I)) {
+			if (isa<CallInst>(CastI->getOperand(0)))
+				FF |= FF_CastFromCall;
+		}
+	}
+
+	return FF;
+}
+
+// Features of F; a function that was not scanned may have all
+unsigned MLTA::getFuncFeatures(Function *F) {
+
+	auto FI = FuncFeaturesMap.find(F);
+	if (FI == FuncFeaturesMap.end())
+		return FF_All;
+	return FI->second;
+}
 
 void MLTA::escapeType(Value *V) {
 
@@ -719,6 +878,43 @@ void MLTA::intersectFuncSets(FuncSet &FS1, FuncSet &FS2,
 	}
 }
 
+// Number the functions in sigFuncsMap, which must be final. Functions
+// of the same signature get consecutive IDs, as target sets never grow
+// beyond the signature of the callsite.
+void MLTA::numberTargetFuncs() {
+
+	FuncIDs.clear();
+	IDFuncs.clear();
+	sigTargetsMap.clear();
+	MatchedTargetsMap.clear();
+
+	for (auto &SF : Ctx->sigFuncsMap) {
+		for (auto F : SF.second) {
+			if (F && FuncIDs.try_emplace(F, IDFuncs.size()).second)
+				IDFuncs.push_back(F);
+		}
+	}
+	for (auto &SF : Ctx->sigFuncsMap)
+		toFuncBitSet(SF.second, sigTargetsMap[SF.first]);
+}
+
+// Functions without an ID can never be targets, so they are dropped
+void MLTA::toFuncBitSet(FuncSet &FS, FuncBitSet &BS) {
+
+	BS.clear();
+	for (auto F : FS) {
+		auto It = FuncIDs.find(F);
+		if (It != FuncIDs.end())
+			BS.insert(It->second);
+	}
+}
+
+void MLTA::toFuncSet(FuncBitSet &BS, FuncSet &FS) {
+
+	FS.clear();
+	BS.forEach([&](unsigned ID) { FS.insert(IDFuncs[ID]); });
+}
+
 Value *MLTA::getVTable(Value *V) {
 	if (BitCastOperator *BCO =
 			dyn_cast<BitCastOperator>(V)) {
@@ -784,30 +980,30 @@ void MLTA::printTypeChain(list<typeidx_t> &Chain) {
 	for (list<typeidx_t>::iterator it = Chain.begin(); 
 			it != Chain.end(); ++it) {
 		typeidx_t TI = *it;
-		OP<<"--<"<<*(TI.first)<<", "<<TI.second<<">";
+		KA_LOG(LL_Debug)<<"--<"<<*(TI.first)<<", "<<TI.second<<">";
 	}
-	OP<<"\n";
+	KA_LOG(LL_Debug)<<"\n";
 }
 
 void MLTA::printTargets(FuncSet &FS, CallInst *CI) {
 
 	if (CI) {
 #ifdef PRINT_SOURCE_LINE
-		OP<<"[CallGraph] Indirect call: "<<*CI<<"\n";
-		OP<<CI->getModule()->getName()<<"\n";
+		KA_LOG(LL_Debug)<<"[CallGraph] Indirect call: "<<*CI<<"\n";
+		KA_LOG(LL_Debug)<<CI->getModule()->getName()<<"\n";
 #endif
 		printSourceCodeInfo(CI, "CALLER");
 		//WriteSourceInfoIntoFile(CI, "IcallInfo.txt");
 	}
-	OP<<"\n\t Indirect-call targets: ("<<FS.size()<<")\n";
+	KA_LOG(LL_Debug)<<"\n\t Indirect-call targets: ("<<FS.size()<<")\n";
 	for (auto F : FS) {
 		if (F->isDeclaration()) {
-			OP<<"ERROR: print declaration function: "<<F->getName()<<"\n";
+			KA_LOG(LL_Debug)<<"ERROR: print declaration function: "<<F->getName()<<"\n";
 			continue;
 		}
 		printSourceCodeInfo(F, "TARGET");
 	}
-	OP<<"\n";
+	KA_LOG(LL_Debug)<<"\n";
 
 #if 0
 	std::ofstream oFile;
@@ -820,9 +1016,40 @@ void MLTA::printTargets(FuncSet &FS, CallInst *CI) {
 // Get the chain of base types for V
 // Complete: whether the chain's end is not escaping---it won't
 // propagate further
+// NOTE: chains are memoized in BaseTypeChainMap, which must be cleared
+// whenever the IR or the alias maps change
 bool MLTA::getBaseTypeChain(list<typeidx_t> &Chain, Value *V,
 		bool &Complete) {
 
+	const BaseTypeChain &BTC = lookupBaseTypeChain(V);
+	Chain.insert(Chain.end(), BTC.Chain.begin(), BTC.Chain.end());
+	Complete = BTC.Complete;
+
+	if (!Chain.empty() && !Complete) {
+		typeCapSet.insert(typeHash(Chain.back().first));
+	}
+
+	return true;
+}
+
+// The memoized chain of V, without the side effects on the type tables
+const MLTA::BaseTypeChain &MLTA::lookupBaseTypeChain(Value *V) {
+
+	auto It = BaseTypeChainMap.find(V);
+	if (It == BaseTypeChainMap.end()) {
+		list<typeidx_t> NewChain;
+		bool Complete;
+		computeBaseTypeChain(NewChain, V, Complete);
+		BaseTypeChain BTC = {
+			vector<typeidx_t>(NewChain.begin(), NewChain.end()), Complete };
+		It = BaseTypeChainMap.insert({V, std::move(BTC)}).first;
+	}
+	return It->second;
+}
+
+void MLTA::computeBaseTypeChain(list<typeidx_t> &Chain, Value *V,
+		bool &Complete) {
+
 	Complete = true;
 	Value *CV = V, *NextV = NULL;
 	list<typeidx_t> TyList;
@@ -860,12 +1087,6 @@ bool MLTA::getBaseTypeChain(list<typeidx_t> &Chain, Value *V,
 		}
 		// TODO: other cases like store?
 	}
-
-	if (!Chain.empty() && !Complete) {
-		typeCapSet.insert(typeHash(Chain.back().first));
-	}
-
-	return true;
 }
 
 // This function is to get the base type in the current layer.
@@ -960,8 +1181,15 @@ bool MLTA::getGEPLayerTypes(GEPOperator *GEP, list<typeidx_t> &TyList) {
 			APInt Offset (ConstI->getBitWidth(), 
 					ConstI->getZExtValue());
 			Type *BaseTy = ETy;
-			SmallVector<APInt>IndiceV = DLMap[I->getModule()]
-				->getGEPIndicesForOffset(BaseTy, Offset);
+			// The data layout caches struct layouts as they are asked
+			// for, while functions of a module may be resolved by
+			// several threads
+			SmallVector<APInt> IndiceV;
+			{
+				lock_guard<mutex> Guard(StructLayoutLock);
+				IndiceV = I->getModule()->getDataLayout()
+					.getGEPIndicesForOffset(BaseTy, Offset);
+			}
 			for (auto Idx : IndiceV) {
 				Indices.push_back(*Idx.getRawData());
 			}
@@ -1118,9 +1346,130 @@ bool MLTA::nextLayerBaseTypeWL(Value *V, list<typeidx_t> &TyList,
 
 // Get the composite type of the lower layer. Layers are split by
 // memory loads or GEP
+// Get the next-layer types of V: it follows loads, casts, selects, and
+// PHIs (their first incoming value that yields types, or the last one)
+// up to the GEP indexing into the next layer. Visited gets the values
+// on the followed path.
+//
+// The walk memoizes the result of each value, so it is linear in the
+// size of the function. A result is only reusable if it does not depend
+// on the path, so the walk gives up on reaching a value on its path,
+// which _nextLayerBaseType() then handles.
 bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList, 
 		Value * &NextV, set<Value *> &Visited) {
 
+	LayerWalk LW(Visited);
+	if (LayerWalkStep *S = walkNextLayer(V, LW)) {
+		NextV = S->NextV;
+		if (S->TypesFrom) {
+			auto &Types = LW.Steps[S->TypesFrom].Types;
+			TyList.insert(TyList.end(), Types.begin(), Types.end());
+		}
+		// Values on the followed path
+		for (Value *PV = V; PV && !isa<Argument>(PV); 
+				PV = LW.Steps[PV].PathNext)
+			Visited.insert(PV);
+		return S->Ret;
+	}
+
+	if (LW.NumSteps <= LAYER_WALK_BUDGET) {
+		list<typeidx_t> NTyList = TyList;
+		set<Value *> NVisited = Visited;
+		bool ret = _nextLayerBaseType(V, NTyList, NextV, NVisited, 
+				LW.NumSteps);
+		if (LW.NumSteps <= LAYER_WALK_BUDGET) {
+			TyList.swap(NTyList);
+			Visited.swap(NVisited);
+			return ret;
+		}
+	}
+
+	// Too complex; take it as having no next layer
+	NextV = NULL;
+	return false;
+}
+
+// Returns NULL if the result depends on the path to V
+MLTA::LayerWalkStep *MLTA::walkNextLayer(Value *V, LayerWalk &LW) {
+
+	auto Res = LW.Steps.try_emplace(V);
+	LayerWalkStep *S = &Res.first->second;
+	if (!Res.second)
+		return S->Done ? S : NULL;
+
+	if (++LW.NumSteps > LAYER_WALK_BUDGET)
+		return NULL;
+
+	if (!V || isa<Argument>(V)) {
+		S->NextV = V;
+		S->Done = true;
+		return S;
+	}
+
+	// On the path of the caller
+	if (LW.Visited.find(V) != LW.Visited.end())
+		return NULL;
+
+	// Values whose next layer is the one of an operand
+	Value *OV = NULL;
+	if (LoadInst *LI = dyn_cast<LoadInst>(V))
+		OV = LI->getOperand(0);
+	else if (BitCastOperator *BCO = dyn_cast<BitCastOperator>(V))
+		OV = BCO->getOperand(0);
+	else if (SelectInst *SelI = dyn_cast<SelectInst>(V))
+		OV = SelI->getTrueValue();
+	else if (UnaryOperator *UO = dyn_cast<UnaryOperator>(V))
+		OV = UO->getOperand(0);
+
+	// NOTE: S may move when new values are added to Steps
+	LayerWalkStep R;
+	if (GEPOperator *GEP = dyn_cast<GEPOperator>(V)) {
+		R.Ret = getGEPLayerTypes(GEP, R.Types);
+		R.NextV = R.Ret ? GEP->getPointerOperand() : NULL;
+		if (R.Ret)
+			R.TypesFrom = V;
+	}
+	else if (OV) {
+		LayerWalkStep *OS = walkNextLayer(OV, LW);
+		if (!OS)
+			return NULL;
+		R.Ret = OS->Ret;
+		R.NextV = OS->NextV;
+		R.TypesFrom = OS->TypesFrom;
+		R.PathNext = OV;
+	}
+	else if (PHINode *PN = dyn_cast<PHINode>(V)) {
+		// FIXME: tracking incoming values
+		if (PN->getNumIncomingValues() == 0)
+			return NULL;
+		for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+			Value *IV = PN->getIncomingValue(i);
+			LayerWalkStep *IS = walkNextLayer(IV, LW);
+			if (!IS)
+				return NULL;
+			R.Ret = IS->Ret;
+			R.NextV = IS->NextV;
+			R.TypesFrom = IS->TypesFrom;
+			R.PathNext = IV;
+			if (R.TypesFrom)
+				break;
+		}
+	}
+
+	R.Done = true;
+	S = &LW.Steps[V];
+	*S = std::move(R);
+	return S;
+}
+
+bool MLTA::_nextLayerBaseType(Value *V, list<typeidx_t> &TyList, 
+		Value * &NextV, set<Value *> &Visited, unsigned &Steps) {
+
+	if (++Steps > LAYER_WALK_BUDGET) {
+		NextV = NULL;
+		return false;
+	}
+
 	if (!V || isa<Argument>(V)) {
 		NextV = V;
 		return false;
@@ -1145,13 +1494,13 @@ bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList,
 	else if (LoadInst *LI = dyn_cast<LoadInst>(V)) {
 
 		NextV = LI->getPointerOperand();
-		return nextLayerBaseType(LI->getOperand(0), TyList, NextV, Visited);
+		return _nextLayerBaseType(LI->getOperand(0), TyList, NextV, Visited, Steps);
 	}
 	else if (BitCastOperator *BCO = 
 			dyn_cast<BitCastOperator>(V)) {
 		
 		NextV = BCO->getOperand(0);
-		return nextLayerBaseType(BCO->getOperand(0), TyList, NextV, Visited);
+		return _nextLayerBaseType(BCO->getOperand(0), TyList, NextV, Visited, Steps);
 	}
 	// Phi and Select 
 	else if (PHINode *PN = dyn_cast<PHINode>(V)) {
@@ -1164,7 +1513,7 @@ bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList,
 			NextV = IV;
 			NVisited = Visited;
 			NTyList = TyList;
-			ret = nextLayerBaseType(IV, NTyList, NextV, NVisited);
+			ret = _nextLayerBaseType(IV, NTyList, NextV, NVisited, Steps);
 			if (NTyList.size() > TyList.size()) {
 				break;
 			}
@@ -1177,45 +1526,177 @@ bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList,
 		// Assuming both operands have same type, so pick the first
 		// operand
 		NextV = SelI->getTrueValue();
-		return nextLayerBaseType(SelI->getTrueValue(), TyList, NextV, Visited);
+		return _nextLayerBaseType(SelI->getTrueValue(), TyList, NextV, Visited, Steps);
 	}
 	// Other unary instructions
 	// FIXME: may introduce false positives
 	else if (UnaryOperator *UO = dyn_cast<UnaryOperator>(V)) {
 
 		NextV = UO->getOperand(0);
-		return nextLayerBaseType(UO->getOperand(0), TyList, NextV, Visited);
+		return _nextLayerBaseType(UO->getOperand(0), TyList, NextV, Visited, Steps);
 	}
 
 	NextV = NULL;
 	return false;
 }
 
-bool MLTA::getDependentTypes(Type *Ty, int Idx, 
-		set<hashidx_t> &PropSet) {
+// Get the types that may propagate targets to (Ty, Idx), directly or
+// transitively. They are precomputed by computePropClosure().
+const vector<hashidx_t> &MLTA::getDependentTypes(Type *Ty, int Idx) {
 
-	list<hashidx_t>LT;
-	LT.push_back(hashidx_c(typeHash(Ty), Idx));
-	set<hashidx_t>Visited;
+	static const vector<hashidx_t> NoTypes;
 
-	while (!LT.empty()) {
-		hashidx_t TI = LT.front();
-		LT.pop_front();
-		if (Visited.find(TI) != Visited.end()) {
+	size_t TyHash = typeHash(Ty);
+	auto It = PropSCCMap.find(hashidx_c(TyHash, Idx));
+	// A field without own propagations only has the ones of all fields
+	if (It == PropSCCMap.end() && Idx != -1)
+		It = PropSCCMap.find(hashidx_c(TyHash, -1));
+	if (It == PropSCCMap.end())
+		return NoTypes;
+
+	return PropClosures[It->second];
+}
+
+// Condense the type propagation graph into SCCs. Levels groups the SCCs
+// such that an SCC only reaches SCCs of lower levels.
+void MLTA::condensePropGraph(vector<vector<unsigned>> &Levels) {
+
+	PropSCCMap.clear();
+	PropSCCs.clear();
+	PropSCCSuccs.clear();
+	PropSCCCyclic.clear();
+	PropClosures.clear();
+	Levels.clear();
+
+	// Number the nodes
+	vector<hashidx_t> Nodes;
+	DenseMap<hashidx_t, unsigned> NodeIDs;
+	auto getNodeID = [&](hashidx_t TI) {
+		auto Res = NodeIDs.try_emplace(TI, Nodes.size());
+		if (Res.second)
+			Nodes.push_back(TI);
+		return Res.first->second;
+	};
+	for (auto &TP : typeIdxPropMap) {
+		for (auto &IP : TP.second) {
+			getNodeID(hashidx_c(TP.first, IP.first));
+			for (auto Prop : IP.second)
+				getNodeID(Prop);
+		}
+	}
+
+	// A (type, idx) gets the propagations to itself and to all fields
+	unsigned NumNodes = Nodes.size();
+	vector<vector<unsigned>> Succs(NumNodes);
+	for (unsigned N = 0; N < NumNodes; ++N) {
+		auto TPIt = typeIdxPropMap.find(Nodes[N].first);
+		if (TPIt == typeIdxPropMap.end())
 			continue;
+		for (int I : {Nodes[N].second, -1}) {
+			auto IPIt = TPIt->second.find(I);
+			if (IPIt == TPIt->second.end())
+				continue;
+			for (auto Prop : IPIt->second)
+				Succs[N].push_back(NodeIDs[Prop]);
+			if (I == -1)
+				break;
 		}
-		Visited.insert(TI);
+	}
+
+	// Tarjan's algorithm, iteratively; an SCC is complete only after
+	// all SCCs it reaches
+	const unsigned Unvisited = ~0U;
+	vector<unsigned> Index(NumNodes, Unvisited), Low(NumNodes);
+	vector<unsigned> NodeSCC(NumNodes);
+	vector<char> OnStack(NumNodes, 0);
+	vector<unsigned> Stack;
+	vector<pair<unsigned, unsigned>> DFS;
+	unsigned NextIndex = 0;
+
+	for (unsigned Root = 0; Root < NumNodes; ++Root) {
+		if (Index[Root] != Unvisited)
+			continue;
+		DFS.emplace_back(Root, 0);
+		while (!DFS.empty()) {
+			unsigned N = DFS.back().first;
+			unsigned &E = DFS.back().second;
+			if (E == 0 && Index[N] == Unvisited) {
+				Index[N] = Low[N] = NextIndex++;
+				Stack.push_back(N);
+				OnStack[N] = 1;
+			}
+			if (E < Succs[N].size()) {
+				unsigned S = Succs[N][E++];
+				if (Index[S] == Unvisited)
+					DFS.emplace_back(S, 0);
+				else if (OnStack[S])
+					Low[N] = std::min(Low[N], Index[S]);
+				continue;
+			}
 
-		for (auto Prop : typeIdxPropMap[TI.first][TI.second]) {
-			PropSet.insert(Prop);
-			LT.push_back(Prop);
+			if (Low[N] == Index[N]) {
+				unsigned SCC = PropSCCs.size();
+				PropSCCs.emplace_back();
+				unsigned M;
+				do {
+					M = Stack.back();
+					Stack.pop_back();
+					OnStack[M] = 0;
+					NodeSCC[M] = SCC;
+					PropSCCs[SCC].push_back(Nodes[M]);
+					PropSCCMap[Nodes[M]] = SCC;
+				} while (M != N);
+			}
+			DFS.pop_back();
+			if (!DFS.empty()) {
+				unsigned P = DFS.back().first;
+				Low[P] = std::min(Low[P], Low[N]);
+			}
 		}
-		for (auto Prop : typeIdxPropMap[TI.first][-1]) {
-			PropSet.insert(Prop);
-			LT.push_back(Prop);
+	}
+
+	// Edges between SCCs, and levels
+	unsigned NumSCCs = PropSCCs.size();
+	PropSCCSuccs.resize(NumSCCs);
+	PropSCCCyclic.resize(NumSCCs, 0);
+	PropClosures.resize(NumSCCs);
+	vector<unsigned> SCCLevels(NumSCCs, 0);
+	for (unsigned N = 0; N < NumNodes; ++N) {
+		unsigned SCC = NodeSCC[N];
+		for (unsigned S : Succs[N]) {
+			if (NodeSCC[S] == SCC)
+				PropSCCCyclic[SCC] = 1;
+			else
+				PropSCCSuccs[SCC].push_back(NodeSCC[S]);
 		}
 	}
-	return true;
+	for (unsigned SCC = 0; SCC < NumSCCs; ++SCC) {
+		auto &SS = PropSCCSuccs[SCC];
+		std::sort(SS.begin(), SS.end());
+		SS.erase(std::unique(SS.begin(), SS.end()), SS.end());
+		for (unsigned S : SS)
+			SCCLevels[SCC] = std::max(SCCLevels[SCC], SCCLevels[S] + 1);
+		if (SCCLevels[SCC] >= Levels.size())
+			Levels.resize(SCCLevels[SCC] + 1);
+		Levels[SCCLevels[SCC]].push_back(SCC);
+	}
+}
+
+// Compute the dependent types of an SCC from the ones of the SCCs it
+// reaches, which must be computed already. SCCs of the same level can
+// be computed concurrently.
+void MLTA::computePropClosure(unsigned SCC) {
+
+	vector<hashidx_t> &Closure = PropClosures[SCC];
+	if (PropSCCCyclic[SCC])
+		Closure = PropSCCs[SCC];
+	for (unsigned S : PropSCCSuccs[SCC]) {
+		Closure.insert(Closure.end(), PropSCCs[S].begin(), PropSCCs[S].end());
+		Closure.insert(Closure.end(), PropClosures[S].begin(),
+				PropClosures[S].end());
+	}
+	std::sort(Closure.begin(), Closure.end());
+	Closure.erase(std::unique(Closure.begin(), Closure.end()), Closure.end());
 }
 
 
@@ -1237,6 +1718,81 @@ Function *MLTA::getBaseFunction(Value *V) {
 	return NULL;
 }
 
+void MLTA::getLayerTypes(CallInst *CI, list<typeidx_t> &Chain) {
+
+	// No layer is walked if the first layer has no targets
+	if (Ctx->sigFuncsMap.find(callHash(CI)) == Ctx->sigFuncsMap.end())
+		return;
+
+	Type *PrevLayerTy = CI->getFunctionType();
+	Value *CV = CI->getCalledOperand();
+	Value *NextV = NULL;
+	int LayerNo = 1;
+
+	list<typeidx_t> TyList;
+	while (LayerNo < MAX_TYPE_LAYER) {
+
+#ifdef SOUND_MODE
+		if (typeCapSet.find(typeHash(PrevLayerTy)) != typeCapSet.end())
+			return;
+#endif
+
+		set<Value *> Visited;
+		nextLayerBaseType(CV, TyList, NextV, Visited);
+		if (TyList.empty())
+			return;
+
+		for (auto TyIdx : TyList) {
+			if (LayerNo >= MAX_TYPE_LAYER)
+				return;
+			++LayerNo;
+
+#ifdef SOUND_MODE
+			// Escaped types do not refine the targets, and end the walk
+			if (typeEscapeSet.count(typeIdxHash(TyIdx.first, TyIdx.second)) ||
+					typeEscapeSet.count(typeIdxHash(TyIdx.first, -1)))
+				return;
+#endif
+			Chain.push_back(TyIdx);
+			CV = NextV;
+
+#ifdef SOUND_MODE
+			if (typeCapSet.find(typeHash(TyIdx.first)) != typeCapSet.end())
+				return;
+#endif
+			PrevLayerTy = TyIdx.first;
+		}
+		TyList.clear();
+	}
+}
+
+// The keys the targets and the escapes of a layer type are looked up
+// with, as findCalleesWithMLTA() does
+void MLTA::addLayerDeps(Type *Ty, int Idx, CallDeps &Deps) {
+
+	size_t TyHash = typeHash(Ty);
+	Deps.Keys.push_back(hashidx_c(TyHash, Idx == -1 ? AnyIdx : Idx));
+	Deps.Keys.push_back(hashidx_c(TyHash, -1));
+	Deps.Keys.push_back(hashidx_c(TyHash, NoIdx));
+	for (auto Prop : getDependentTypes(Ty, Idx)) {
+		Deps.Keys.push_back(
+				hashidx_c(Prop.first, Prop.second == -1 ? AnyIdx : Prop.second));
+		Deps.Keys.push_back(hashidx_c(Prop.first, -1));
+	}
+}
+
+void MLTA::countLayerTargets(char Layer, size_t NumTargets) {
+
+	if (Layer > 1) {
+		Ctx->NumSecondLayerTypeCalls++;
+		Ctx->NumSecondLayerTargets += NumTargets;
+	}
+	else if (Layer == 1) {
+		Ctx->NumFirstLayerTargets += NumTargets;
+		Ctx->NumFirstLayerTypeCalls += 1;
+	}
+}
+
 // Get all possible targets of the given type
 bool MLTA::getTargetsWithLayerType(size_t TyHash, int Idx, 
 		FuncSet &FS) {
@@ -1244,15 +1800,25 @@ bool MLTA::getTargetsWithLayerType(size_t TyHash, int Idx,
 	// Get the direct funcset in the current layer, which
 	// will be further unioned with other targets from type
 	// casting
+	// NOTE: lookups must not insert, as the map is shared by the
+	// workers resolving indirect calls
+	auto TFIt = typeIdxFuncsMap.find(TyHash);
+	if (Idx != -1)
+		FS.clear();
+	if (TFIt == typeIdxFuncsMap.end())
+		return true;
+
 	if (Idx == -1) {
-		for (auto FSet : typeIdxFuncsMap[TyHash]) {
+		for (auto &FSet : TFIt->second) {
 			FS.insert(FSet.second.begin(), FSet.second.end());
 		}
 	}
 	else {
-		FS = typeIdxFuncsMap[TyHash][Idx];
-		FS.insert(typeIdxFuncsMap[TyHash][-1].begin(), 
-				typeIdxFuncsMap[TyHash][-1].end());
+		for (int I : {Idx, -1}) {
+			auto IFIt = TFIt->second.find(I);
+			if (IFIt != TFIt->second.end())
+				FS.insert(IFIt->second.begin(), IFIt->second.end());
+		}
 	}
 
 	return true;
@@ -1260,18 +1826,30 @@ bool MLTA::getTargetsWithLayerType(size_t TyHash, int Idx,
 
 // The API for MLTA: it returns functions for an indirect call
 bool MLTA::findCalleesWithMLTA(CallInst *CI, 
-		FuncSet &FS) {
+		FuncSet &FS, CallDeps *Deps) {
 
 	// Initial set: first-layer results
 	// TODO: handling virtual functions
-	FS = Ctx->sigFuncsMap[callHash(CI)];
+	auto SFIt = Ctx->sigFuncsMap.find(callHash(CI));
+	if (SFIt != Ctx->sigFuncsMap.end())
+		FS = SFIt->second;
+	else
+		FS.clear();
+
+	if (Deps)
+		Deps->Keys.push_back(hashidx_c(callHash(CI), NoIdx));
 
 	if (FS.empty()) {
 		// No need to go through MLTA if the first layer is empty
 		return false;
 	}
 
-	FuncSet FS1, FS2;
+	// Targets are refined as bitsets
+	FuncBitSet Targets, LayerTargets;
+	auto STIt = sigTargetsMap.find(SFIt->first);
+	if (STIt != sigTargetsMap.end())
+		Targets = STIt->second;
+
 	Type *PrevLayerTy = (dyn_cast<CallBase>(CI))->getFunctionType();
 	int PrevIdx = -1;
 	Value *CV = CI->getCalledOperand();
@@ -1288,6 +1866,8 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 			break;
 
 #ifdef SOUND_MODE
+		if (Deps)
+			Deps->Keys.push_back(hashidx_c(typeHash(PrevLayerTy), NoIdx));
 		if (typeCapSet.find(typeHash(PrevLayerTy)) != typeCapSet.end()) {
 			break;
 		}
@@ -1316,11 +1896,11 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 			// -1 represents all possible fields of a struct
 			size_t TyIdxHash_1 = typeIdxHash(TyIdx.first, -1);
 
+			if (Deps)
+				addLayerDeps(TyIdx.first, TyIdx.second, *Deps);
+
 			// Caching for performance
-			if (MatchedFuncsMap.find(TyIdxHash) != MatchedFuncsMap.end()) {
-				FS1 = MatchedFuncsMap[TyIdxHash];
-			}
-			else {
+			if (!MatchedTargetsMap.lookup(TyIdxHash, LayerTargets)) {
 
 #ifdef SOUND_MODE
 				if (typeEscapeSet.find(TyIdxHash) 
@@ -1352,23 +1932,23 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 				}
 #endif
 
+				FuncSet FS1, FS2;
 				getTargetsWithLayerType(typeHash(TyIdx.first), TyIdx.second, FS1);
 
 				// Collect targets from dependent types that may propagate
 				// targets to it
-				set<hashidx_t> PropSet;
-				getDependentTypes(TyIdx.first, TyIdx.second, PropSet);
-				for (auto Prop : PropSet) {
+				for (auto Prop : getDependentTypes(TyIdx.first, TyIdx.second)) {
+					FS2.clear();
 					getTargetsWithLayerType(Prop.first, Prop.second, FS2);
 					FS1.insert(FS2.begin(), FS2.end());
 				}
-				MatchedFuncsMap[TyIdxHash] = FS1;
+				toFuncBitSet(FS1, LayerTargets);
+				MatchedTargetsMap.insert(TyIdxHash, LayerTargets);
 			}
 
 			// Next layer may not always have a subset of the previous layer
 			// because of casting, so let's do intersection
-			intersectFuncSets(FS1, FS, FS2);
-			FS = FS2;
+			Targets &= LayerTargets;
 
 			CV = NextV;
 
@@ -1385,14 +1965,13 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 		TyList.clear();
 	}
 
-	if (LayerNo > 1) {
-		Ctx->NumSecondLayerTypeCalls++;
-		Ctx->NumSecondLayerTargets += FS.size();
-	}
-	else {
-		Ctx->NumFirstLayerTargets += Ctx->sigFuncsMap[callHash(CI)].size();
-		Ctx->NumFirstLayerTypeCalls += 1;
-	}
+	if (LayerNo > 1)
+		toFuncSet(Targets, FS);
+	// The first layer has all targets otherwise
+	char Layer = LayerNo > 1 ? 2 : 1;
+	countLayerTargets(Layer, FS.size());
+	if (Deps)
+		Deps->Layer = Layer;
 
 #if 0
 	FuncSet FSBase = Ctx->sigFuncsMap[callHash(CI)];
@@ -3,6 +3,7 @@
 
 #include "Analyzer.h"
 #include "Config.h"
+#include "Summary.h"
 #include "llvm/IR/Operator.h"
 
 typedef pair<Type *, int> typeidx_t;
@@ -36,8 +37,9 @@ class MLTA {
 		////////////////////////////////////////////////////////////////
 		// Other data structures
 		////////////////////////////////////////////////////////////////
-		// Cache matched functions for CallInst
-		DenseMap<size_t, FuncSet>MatchedFuncsMap;
+		// Cache matched functions for CallInst; shared by the
+		// workers resolving indirect calls
+		ShardedMap<size_t, FuncSetRef>MatchedFuncsMap;
 		DenseMap<Value *, FuncSet>VTableFuncsMap;
 
 		set<size_t>srcLnHashSet;
@@ -47,7 +49,44 @@ class MLTA {
 		map<size_t, set<size_t>>L1CalleesSrcMap;
 
 		// Matched icall types -- to avoid repeatation
-		DenseMap<size_t, FuncSet> MatchedICallTypeMap;
+		ShardedMap<size_t, FuncSetRef> MatchedICallTypeMap;
+
+		// Dense IDs of the possible targets of indirect calls, i.e.,
+		// the functions in sigFuncsMap, for bitset target sets
+		DenseMap<Function *, unsigned> FuncIDs;
+		vector<Function *> IDFuncs;
+		// sigFuncsMap as bitsets
+		DenseMap<size_t, FuncBitSet> sigTargetsMap;
+		// Cache targets of a layer type and its dependent types
+		ShardedMap<size_t, FuncBitSet> MatchedTargetsMap;
+
+		// SCCs of the type propagation graph, where a (type, idx)
+		// has edges to the ones propagating to it. SCCs are numbered
+		// in reverse topological order.
+		DenseMap<hashidx_t, unsigned> PropSCCMap;
+		vector<vector<hashidx_t>> PropSCCs;
+		vector<vector<unsigned>> PropSCCSuccs;
+		vector<char> PropSCCCyclic;
+		// Dependent types of each SCC, sorted
+		vector<vector<hashidx_t>> PropClosures;
+
+		// Memo of base-type chains of values, as the same pointers are
+		// stored to over and over
+		struct BaseTypeChain {
+			vector<typeidx_t> Chain;
+			bool Complete;
+		};
+		DenseMap<Value *, BaseTypeChain> BaseTypeChainMap;
+
+		// Functions passed to declared functions. When set, they are
+		// collected here instead of being confined through the
+		// definitions, which may be in modules not in memory.
+		struct CallArgConfinement {
+			Function *F;
+			uint64_t CalleeGUID;
+			int8_t ArgNo;
+		};
+		vector<CallArgConfinement> *DeferredCallArgs;
 
 		// Set of target types
 		set<size_t>TTySet;
@@ -59,6 +98,9 @@ class MLTA {
 
 		// Alias struct pointer of a general pointer
 		map<Function *, map<Value *, Value *>>AliasStructPtrMap;
+		// The alias maps used for lookups. Workers of the parallel
+		// initialization look into the ones merged into the pass.
+		map<Function *, map<Value *, Value *>> *SharedAliasMap;
 
 
 
@@ -74,17 +116,44 @@ class MLTA {
 		void escapeType(Value *V);
 		void propagateType(Value *ToV, Type *FromTy, int Idx = -1);
 
+		// Result of walking from a value to the next layer
+		struct LayerWalkStep {
+			bool Done = false;
+			bool Ret = false;
+			Value *NextV = NULL;
+			// The next value on the followed path, and the GEP at its
+			// end if it yields types
+			Value *PathNext = NULL;
+			Value *TypesFrom = NULL;
+			// Types of a GEP
+			list<typeidx_t> Types;
+		};
+		struct LayerWalk {
+			LayerWalk(set<Value *> &Visited_) : Visited(Visited_) {}
+			set<Value *> &Visited;
+			DenseMap<Value *, LayerWalkStep> Steps;
+			unsigned NumSteps = 0;
+		};
+		LayerWalkStep *walkNextLayer(Value *V, LayerWalk &LW);
+
 		Type *getBaseType(Value *V, set<Value *> &Visited);
 		Type *_getPhiBaseType(PHINode *PN, set<Value *> &Visited);
 		Function *getBaseFunction(Value *V);
 		bool nextLayerBaseType(Value *V, list<typeidx_t> &TyList, 
 				Value * &NextV, set<Value *> &Visited);
+		bool _nextLayerBaseType(Value *V, list<typeidx_t> &TyList, 
+				Value * &NextV, set<Value *> &Visited, unsigned &Steps);
 		bool nextLayerBaseTypeWL(Value *V, list<typeidx_t> &TyList, 
 				Value * &NextV);
 		bool getGEPLayerTypes(GEPOperator *GEP, list<typeidx_t> &TyList);
 		bool getBaseTypeChain(list<typeidx_t> &Chain, Value *V, 
 				bool &Complete);
-		bool getDependentTypes(Type *Ty, int Idx, set<hashidx_t> &PropSet);
+		const BaseTypeChain &lookupBaseTypeChain(Value *V);
+		void computeBaseTypeChain(list<typeidx_t> &Chain, Value *V,
+				bool &Complete);
+		const vector<hashidx_t> &getDependentTypes(Type *Ty, int Idx);
+		void condensePropGraph(vector<vector<unsigned>> &Levels);
+		void computePropClosure(unsigned SCC);
 
 
 		////////////////////////////////////////////////////////////////
@@ -93,11 +162,47 @@ class MLTA {
 		void confineTargetFunction(Value *V, Function *F);
 		void intersectFuncSets(FuncSet &FS1, FuncSet &FS2,
 				FuncSet &FS); 
+		void numberTargetFuncs();
+		void toFuncBitSet(FuncSet &FS, FuncBitSet &BS);
+		void toFuncSet(FuncBitSet &BS, FuncSet &FS);
 		bool typeConfineInInitializer(GlobalVariable *GV);
-		bool typeConfineInFunction(Function *F);
-		bool typePropInFunction(Function *F);
+
+		// Handlers of instructions for the type analyses. A single
+		// sweep over a function dispatches each instruction to all
+		// handlers of its kind.
+		enum InstKind {
+			IK_Store = 1 << 0,
+			IK_Call = 1 << 1,
+		};
+		typedef void (MLTA::*InstHandlerFn)(Instruction *I);
+		struct InstHandler {
+			unsigned Kinds;
+			InstHandlerFn Fn;
+		};
+		void visitInstructions(Function *F,
+				const vector<InstHandler> &Handlers);
+		void confineInStore(Instruction *I);
+		void confineInCall(Instruction *I);
+		void propagateInStore(Instruction *I);
 		void collectAliasStructPtr(Function *F);
 
+		// Features of a function body, found by a pre-scan, that tell
+		// which phases can skip the function
+		enum FuncFeature {
+			FF_ICall = 1 << 0,			// Indirect calls
+			FF_Call = 1 << 1,			// Any calls
+			FF_Store = 1 << 2,			// Stores of non-constant values
+			FF_FuncArg = 1 << 3,		// Function addresses as call arguments
+			FF_Memcpy = 1 << 4,			// Struct copies with memcpy
+			FF_CastFromCall = 1 << 5,	// Casts of call results
+			FF_All = (1 << 6) - 1,
+			// Features the initialization analyses act on
+			FF_TypeInit = FF_Store | FF_FuncArg | FF_Memcpy | FF_CastFromCall,
+		};
+		DenseMap<Function *, unsigned> FuncFeaturesMap;
+		unsigned scanFuncFeatures(Function *F);
+		unsigned getFuncFeatures(Function *F);
+
 		// deprecated 
 		//bool typeConfineInStore(StoreInst *SI);
 		//bool typePropWithCast(User *Cast);
@@ -107,9 +212,29 @@ class MLTA {
 		////////////////////////////////////////////////////////////////
 		// API functions
 		////////////////////////////////////////////////////////////////
+		// What the targets of an indirect call depend on, so that they
+		// can be reused while none of it changes
+		struct CallDeps {
+			// (type, idx) keys of the type tables looked up. AnyIdx
+			// stands for all fields of the type, and NoIdx for what is
+			// kept of the type itself: caps and address-taken functions
+			// of function types.
+			vector<hashidx_t> Keys;
+			// 0 if the first layer has no targets, 1 if the targets are
+			// of the first layer, 2 if refined by more layers
+			char Layer = 0;
+		};
+		enum {
+			AnyIdx = INT_MIN,
+			NoIdx = INT_MIN + 1,
+		};
+
 		// Use type-based analysis to find targets of indirect calls
 		void findCalleesWithType(CallInst*, FuncSet&);
-		bool findCalleesWithMLTA(CallInst *CI, FuncSet &FS);
+		bool findCalleesWithMLTA(CallInst *CI, FuncSet &FS,
+				CallDeps *Deps = NULL);
+		void addLayerDeps(Type *Ty, int Idx, CallDeps &Deps);
+		void countLayerTargets(char Layer, size_t NumTargets);
 		bool getTargetsWithLayerType(size_t TyHash, int Idx, 
 				FuncSet &FS);
 
@@ -120,24 +245,48 @@ class MLTA {
 		bool isCompositeType(Type *Ty);
 		Type *getFuncPtrType(Value *V);
 		Value *recoverBaseType(Value *V);
-		void unrollLoops(Function *F);
 		void saveCalleesInfo(CallInst *CI, FuncSet &FS, bool mlta);
 		void printTargets(FuncSet &FS, CallInst *CI = NULL);
 		void printTypeChain(list<typeidx_t> &Chain);
 
 
-	public:
+		////////////////////////////////////////////////////////////////
+		// Merging the results of workers
+		////////////////////////////////////////////////////////////////
+		void mergeAliasStructPtrs(MLTA &W);
+		void mergeFuncFeatures(MLTA &W);
+		void mergeTypeTables(MLTA &W);
 
-		// General pointer types like char * and void *
-		map<Module *, Type *>Int8PtrTy;
-		// long interger type
-		map<Module *, Type *>IntPtrTy;
-		map<Module *, const DataLayout *>DLMap;
+
+	public:
 
 		MLTA(GlobalContext *Ctx_) {
 			Ctx = Ctx_;
+			SharedAliasMap = &AliasStructPtrMap;
+			DeferredCallArgs = NULL;
+		}
+
+		// A worker of the parallel initialization of Pass. It fills its
+		// own type tables, which are merged into Pass afterwards.
+		MLTA(MLTA *Pass) : MLTA(Pass->Ctx) {
+			SharedAliasMap = &Pass->AliasStructPtrMap;
 		}
 
+		// Per-module steps of the initialization. Funcs receives the
+		// functions whose bodies may affect the type tables.
+		void collectAliasInModule(Module *M, vector<Function *> &Funcs);
+		void typeInitInModule(Module *M, vector<Function *> &Funcs);
+
+		// Run the initialization on M alone and move its results into
+		// S. It must be called on a worker with its own alias maps.
+		void summarizeModule(Module *M, ModuleSummary &S);
+		// Drop what is kept about the functions of M
+		void forgetModule(Module *M);
+
+		// The layer types findCalleesWithMLTA() refines the targets of
+		// an indirect call with, up to a cap type or an escaped type
+		void getLayerTypes(CallInst *CI, list<typeidx_t> &Chain);
+
 };
 
 #endif
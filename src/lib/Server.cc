@@ -0,0 +1,344 @@
+//===-- Server.cc - Queries on resident analysis results -------===//
+//
+// The results of the analysis are kept in the global context after it
+// finishes, so queries are answered from indexes built once over them.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/IR/IntrinsicInst.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "Server.h"
+#include "Common.h"
+
+using namespace llvm;
+
+static string getLocPath(DILocation *Loc) {
+	return getSourcePath(Loc->getDirectory(), Loc->getFilename());
+}
+
+void QueryServer::buildIndex() {
+
+	for (auto &entry : Ctx->Callees) {
+		CallInst *CI = entry.first;
+		DILocation *Loc = CI->getDebugLoc().get();
+		if (!Loc || isa<IntrinsicInst>(CI))
+			continue;
+		CallSitesByLoc[getLocPath(Loc)][Loc->getLine()].push_back(CI);
+	}
+
+	for (auto &M : Ctx->Modules) {
+		for (Function &F : *M.first)
+			FuncsByName[F.getName()].push_back(&F);
+	}
+}
+
+// Call sites at FILE:LINE, in the order of their locations
+bool QueryServer::findCallSites(StringRef Loc, vector<CallInst *> &CallSites,
+		string &Error) {
+
+	StringRef File, LineStr;
+	std::tie(File, LineStr) = Loc.rsplit(':');
+	unsigned Line;
+	if (File.empty() || LineStr.getAsInteger(10, Line)) {
+		Error = "expected FILE:LINE";
+		return false;
+	}
+
+	for (auto &Path : CallSitesByLoc) {
+		StringRef P = Path.getKey();
+		if (P != File && !(P.endswith(File) && File.front() != '/'
+					&& P[P.size() - File.size() - 1] == '/'))
+			continue;
+		auto It = Path.getValue().find(Line);
+		if (It != Path.getValue().end())
+			CallSites.insert(CallSites.end(), It->second.begin(),
+					It->second.end());
+	}
+
+	auto Key = [](CallInst *CI) {
+		DILocation *Loc = CI->getDebugLoc().get();
+		return make_tuple(getLocPath(Loc), Loc->getColumn(),
+				CI->getFunction()->getName());
+	};
+	std::stable_sort(CallSites.begin(), CallSites.end(),
+			[&](CallInst *A, CallInst *B) { return Key(A) < Key(B); });
+	return true;
+}
+
+static void writeCallSite(CallInst *CI, json::OStream &J) {
+
+	J.attribute("caller", CI->getFunction()->getName());
+	if (DILocation *Loc = CI->getDebugLoc().get()) {
+		J.attribute("file", getLocPath(Loc));
+		J.attribute("line", Loc->getLine());
+		J.attribute("column", Loc->getColumn());
+	}
+	J.attribute("indirect", CI->isIndirectCall());
+}
+
+void QueryServer::answerCallees(StringRef Loc, json::OStream &J) {
+
+	vector<CallInst *> CallSites;
+	string Error;
+	if (!findCallSites(Loc, CallSites, Error)) {
+		J.attribute("error", Error);
+		return;
+	}
+
+	J.attributeArray("sites", [&] {
+		for (auto CI : CallSites) {
+			vector<string> Callees;
+			for (Function *F : Ctx->Callees[CI]) {
+				if (!F->isIntrinsic())
+					Callees.push_back(F->getName().str());
+			}
+			std::sort(Callees.begin(), Callees.end());
+			Callees.erase(std::unique(Callees.begin(), Callees.end()),
+					Callees.end());
+
+			J.object([&] {
+				writeCallSite(CI, J);
+				J.attributeArray("callees", [&] {
+					for (auto &Name : Callees)
+						J.value(Name);
+				});
+			});
+		}
+	});
+}
+
+void QueryServer::answerCallers(StringRef Name, json::OStream &J) {
+
+	auto It = FuncsByName.find(Name);
+	if (It == FuncsByName.end()) {
+		J.attribute("error", "no function named " + Name.str());
+		return;
+	}
+
+	// Declarations of the same function are merged; local functions are
+	// told apart by their modules
+	map<StringRef, vector<Function *>> Scopes;
+	for (auto F : It->second) {
+		StringRef Scope;
+		if (F->hasLocalLinkage())
+			Scope = F->getParent()->getModuleIdentifier();
+		Scopes[Scope].push_back(F);
+	}
+
+	J.attributeArray("functions", [&] {
+		for (auto &S : Scopes) {
+			DISubprogram *SP = NULL;
+			vector<CallInst *> CallSites;
+			for (auto F : S.second) {
+				if (!SP)
+					SP = F->getSubprogram();
+				auto CIt = Ctx->Callers.find(F);
+				if (CIt != Ctx->Callers.end())
+					CallSites.insert(CallSites.end(), CIt->second.begin(),
+							CIt->second.end());
+			}
+			std::sort(CallSites.begin(), CallSites.end());
+			CallSites.erase(std::unique(CallSites.begin(), CallSites.end()),
+					CallSites.end());
+			auto Key = [](CallInst *CI) {
+				DILocation *Loc = CI->getDebugLoc().get();
+				return make_tuple(CI->getFunction()->getName(),
+						Loc ? getLocPath(Loc) : string(),
+						Loc ? Loc->getLine() : 0, Loc ? Loc->getColumn() : 0);
+			};
+			std::stable_sort(CallSites.begin(), CallSites.end(),
+					[&](CallInst *A, CallInst *B) { return Key(A) < Key(B); });
+
+			J.object([&] {
+				J.attribute("name", Name);
+				if (SP) {
+					J.attribute("file",
+							getSourcePath(SP->getDirectory(), SP->getFilename()));
+					J.attribute("line", SP->getLine());
+				}
+				J.attributeArray("callers", [&] {
+					for (auto CI : CallSites)
+						J.object([&] { writeCallSite(CI, J); });
+				});
+			});
+		}
+	});
+}
+
+void QueryServer::answerTypeChain(StringRef Loc, json::OStream &J) {
+
+	vector<CallInst *> CallSites;
+	string Error;
+	if (!findCallSites(Loc, CallSites, Error)) {
+		J.attribute("error", Error);
+		return;
+	}
+
+	J.attributeArray("sites", [&] {
+		for (auto CI : CallSites) {
+			if (!CI->isIndirectCall())
+				continue;
+			list<typeidx_t> Chain;
+			Pass->getLayerTypes(CI, Chain);
+
+			J.object([&] {
+				writeCallSite(CI, J);
+				J.attributeArray("chain", [&] {
+					for (auto &TI : Chain) {
+						string TyStr;
+						raw_string_ostream TyOS(TyStr);
+						TI.first->print(TyOS, false, true);
+						J.object([&] {
+							J.attribute("type", TyOS.str());
+							J.attribute("index", TI.second);
+						});
+					}
+				});
+			});
+		}
+	});
+}
+
+void QueryServer::answer(StringRef Query, raw_ostream &OS) {
+
+	StringRef Cmd, Arg;
+	std::tie(Cmd, Arg) = Query.trim().split(' ');
+	Arg = Arg.trim();
+
+	json::OStream J(OS);
+	J.object([&] {
+		if (Cmd == "callees")
+			answerCallees(Arg, J);
+		else if (Cmd == "callers")
+			answerCallers(Arg, J);
+		else if (Cmd == "typechain")
+			answerTypeChain(Arg, J);
+		else if (Cmd == "shutdown") {
+			Stopping = true;
+			J.attribute("ok", true);
+		}
+		else
+			J.attribute("error", "unknown query " + Cmd.str());
+	});
+	OS << "\n";
+}
+
+static bool sendAll(int FD, StringRef Data) {
+
+	while (!Data.empty()) {
+		ssize_t N = send(FD, Data.data(), Data.size(), MSG_NOSIGNAL);
+		if (N < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		Data = Data.drop_front(N);
+	}
+	return true;
+}
+
+// Answer the queries of a client, a batch of whole lines at a time
+void QueryServer::serveClient(int FD) {
+
+	string In;
+	char Buf[65536];
+	bool Eof = false;
+	while (!Eof && !Stopping) {
+		ssize_t N = read(FD, Buf, sizeof(Buf));
+		if (N < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		if (N == 0)
+			Eof = true;
+		else
+			In.append(Buf, N);
+
+		string Out;
+		raw_string_ostream OS(Out);
+		StringRef Pending(In);
+		while (!Stopping) {
+			size_t End = Pending.find('\n');
+			// The last query of a client may lack a newline
+			if (End == StringRef::npos && !(Eof && !Pending.trim().empty()))
+				break;
+			StringRef Query = Pending.substr(0, End);
+			Pending = End == StringRef::npos ? StringRef()
+				: Pending.drop_front(End + 1);
+			if (!Query.trim().empty())
+				answer(Query, OS);
+		}
+		In = Pending.str();
+		if (!sendAll(FD, OS.str()))
+			return;
+	}
+}
+
+bool QueryServer::serve(StringRef SocketPath) {
+
+	sockaddr_un Addr;
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sun_family = AF_UNIX;
+	if (SocketPath.size() >= sizeof(Addr.sun_path)) {
+		KA_LOG(LL_Error) << "Socket path too long: " << SocketPath << "\n";
+		return false;
+	}
+	memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+
+	// A socket left by an earlier server is replaced, but nothing else;
+	// sys::fs::remove() only removes files, directories and links
+	struct stat St;
+	if (!lstat(Addr.sun_path, &St)) {
+		if (!S_ISSOCK(St.st_mode)) {
+			KA_LOG(LL_Error) << "Cannot listen on " << SocketPath
+				<< ": the path exists and is not a socket\n";
+			return false;
+		}
+		unlink(Addr.sun_path);
+	}
+	else if (errno != ENOENT) {
+		KA_LOG(LL_Error) << "Cannot listen on " << SocketPath << ": "
+			<< strerror(errno) << "\n";
+		return false;
+	}
+
+	int Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (Sock < 0) {
+		KA_LOG(LL_Error) << "Cannot create socket: " << strerror(errno) << "\n";
+		return false;
+	}
+	if (bind(Sock, (sockaddr *)&Addr, sizeof(Addr)) || listen(Sock, 16)) {
+		KA_LOG(LL_Error) << "Cannot listen on " << SocketPath << ": "
+			<< strerror(errno) << "\n";
+		close(Sock);
+		return false;
+	}
+
+	buildIndex();
+	OP << "Serving queries on " << SocketPath << "\n";
+	flushLog();
+
+	while (!Stopping) {
+		int FD = accept(Sock, NULL, NULL);
+		if (FD < 0) {
+			if (errno == EINTR)
+				continue;
+			KA_LOG(LL_Error) << "Cannot accept clients: " << strerror(errno) << "\n";
+			break;
+		}
+		serveClient(FD);
+		close(FD);
+	}
+
+	close(Sock);
+	unlink(Addr.sun_path);
+	return Stopping;
+}
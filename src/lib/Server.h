@@ -0,0 +1,53 @@
+#ifndef _QUERY_SERVER_H
+#define _QUERY_SERVER_H
+
+#include "Analyzer.h"
+#include "MLTA.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/JSON.h"
+
+//
+// Answers queries on the results kept in memory after the analysis,
+// over a Unix domain socket. A client sends queries one per line, in
+// batches of any size, and reads one JSON object per line for each,
+// in order:
+//
+//   callees FILE:LINE    the call sites at the line, with their callees
+//   callers FUNCTION     the call sites that may call the function
+//   typechain FILE:LINE  the layer types of the indirect calls at the line
+//   shutdown             stops the server
+//
+// FILE is matched against the paths of the debug info, as a whole or
+// as a trailing part starting at a '/'. Clients are served one at a
+// time.
+//
+class QueryServer {
+
+	GlobalContext *Ctx;
+	MLTA *Pass;
+
+	// Call sites by path and line
+	StringMap<map<unsigned, vector<CallInst *>>> CallSitesByLoc;
+	StringMap<vector<Function *>> FuncsByName;
+	bool Stopping = false;
+
+	void buildIndex();
+	bool findCallSites(StringRef Loc, vector<CallInst *> &CallSites,
+			string &Error);
+
+	void answerCallees(StringRef Loc, json::OStream &J);
+	void answerCallers(StringRef Name, json::OStream &J);
+	void answerTypeChain(StringRef Loc, json::OStream &J);
+	void answer(StringRef Query, raw_ostream &OS);
+	void serveClient(int FD);
+
+public:
+
+	QueryServer(GlobalContext *Ctx_, MLTA *Pass_) : Ctx(Ctx_), Pass(Pass_) {}
+
+	// Serve until a shutdown query; false if the socket cannot be set up
+	bool serve(StringRef SocketPath);
+};
+
+#endif
@@ -0,0 +1,449 @@
+//===-- Summary.cc - On-disk cache of module summaries ---------===//
+//
+// Summaries and resolution states are serialized in a little-endian
+// binary format. Type hashes are interned IDs, which are only valid
+// within a run, so the types are written as indices into a table of
+// their strings.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/DataExtractor.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include "Summary.h"
+#include "Common.h"
+#include "Config.h"
+
+using namespace llvm;
+
+// Bump the version whenever the format or the analyses change
+static const char SummaryMagic[8] = {'K', 'A', 'S', 'U', 'M', 'M', 0, 0};
+static const char StateMagic[8] = {'K', 'A', 'S', 'T', 'A', 'T', 'E', 0};
+static const uint32_t SummaryVersion = 1;
+
+namespace {
+
+struct SummaryWriter {
+
+	raw_ostream &OS;
+	support::endian::Writer W;
+	DenseMap<uint32_t, uint32_t> TypeIdx;
+	std::vector<uint32_t> Types;
+
+	SummaryWriter(raw_ostream &OS_) : OS(OS_), W(OS_, support::little) {}
+
+	void u8(uint8_t V) { W.write(V); }
+	void u32(uint32_t V) { W.write(V); }
+	void u64(uint64_t V) { W.write(V); }
+	void str(StringRef S) {
+		u32(S.size());
+		OS << S;
+	}
+	void type(size_t Hash) {
+		assert(Hash <= UINT32_MAX);
+		auto It = TypeIdx.try_emplace(Hash, Types.size());
+		if (It.second)
+			Types.push_back(Hash);
+		u32(It.first->second);
+	}
+	// A type hash packed with an index by hashIdxHash()
+	void typeIdx(size_t Hash) {
+		type(Hash >> 32);
+		u32((uint32_t)Hash);
+	}
+};
+
+struct SummaryReader {
+
+	DataExtractor DE;
+	DataExtractor::Cursor C;
+	std::vector<size_t> Types;
+	unsigned NumFuncs = 0;
+	bool Bad = false;
+
+	SummaryReader(StringRef Data) : DE(Data, true, 8), C(0) {}
+
+	uint8_t u8() { return DE.getU8(C); }
+	uint32_t u32() { return DE.getU32(C); }
+	uint64_t u64() { return DE.getU64(C); }
+	std::string str() {
+		uint32_t Size = u32();
+		return DE.getBytes(C, Size).str();
+	}
+	size_t type() {
+		uint32_t Idx = u32();
+		if (Idx < Types.size())
+			return Types[Idx];
+		Bad = true;
+		return 0;
+	}
+	size_t typeIdx() {
+		size_t Hash = type();
+		return hashIdxHash(Hash, (int)u32());
+	}
+	unsigned func() {
+		uint32_t Idx = u32();
+		if (Idx < NumFuncs)
+			return Idx;
+		Bad = true;
+		return 0;
+	}
+	// Counts of records are checked against the data left, so corrupt
+	// ones cannot make the reader allocate much
+	uint32_t count() {
+		uint32_t N = u32();
+		if (N > DE.size() - C.tell()) {
+			Bad = true;
+			return 0;
+		}
+		return N;
+	}
+	bool ok() {
+		return C && !Bad;
+	}
+
+	~SummaryReader() {
+		consumeError(C.takeError());
+	}
+};
+
+} // namespace
+
+static void writeSummary(SummaryWriter &W, const ModuleSummary &S) {
+
+	W.str(S.SourceFileName);
+
+	W.u32(S.Funcs.size());
+	for (auto &Sym : S.Funcs) {
+		W.str(Sym.Name);
+		W.u64(Sym.GUID);
+		W.u8(Sym.Linkage);
+		W.u8(Sym.IsDeclaration);
+		W.str(Sym.EntryName);
+	}
+
+	W.u32(S.AddrTakenFuncs.size());
+	for (auto &AT : S.AddrTakenFuncs) {
+		W.type(AT.first);
+		W.u32(AT.second);
+	}
+	W.u32(S.Confinements.size());
+	for (auto &C : S.Confinements) {
+		W.type(std::get<0>(C));
+		W.u32(std::get<1>(C));
+		W.u32(std::get<2>(C));
+	}
+	W.u32(S.Propagations.size());
+	for (auto &P : S.Propagations) {
+		W.type(std::get<0>(P));
+		W.u32(std::get<1>(P));
+		W.type(std::get<2>(P));
+		W.u32(std::get<3>(P));
+	}
+	W.u32(S.Escapes.size());
+	for (auto E : S.Escapes)
+		W.typeIdx(E);
+	W.u32(S.Caps.size());
+	for (auto C : S.Caps)
+		W.type(C);
+	W.u32(S.StoredFuncs.size());
+	for (auto F : S.StoredFuncs)
+		W.u32(F);
+
+	W.u32(S.ArgSinks.size());
+	for (auto &Sink : S.ArgSinks) {
+		W.u32(Sink.Func);
+		W.u8(Sink.ArgNo);
+		W.u8(Sink.Complete);
+		W.u32(Sink.Chain.size());
+		for (auto &TI : Sink.Chain) {
+			W.type(TI.first);
+			W.u32(TI.second);
+		}
+	}
+	W.u32(S.CallArgs.size());
+	for (auto &CA : S.CallArgs) {
+		W.u32(CA.Func);
+		W.type(CA.FuncHash);
+		W.u64(CA.CalleeGUID);
+		W.u8(CA.ArgNo);
+	}
+
+	W.u32(S.StructNames.size());
+	for (auto &SN : S.StructNames) {
+		W.str(SN.first);
+		W.str(SN.second);
+	}
+	W.u32(S.StructNameDeps.size());
+	for (auto &D : S.StructNameDeps) {
+		W.str(D.first);
+		W.u32(D.second.size());
+		for (auto &Name : D.second)
+			W.str(Name);
+	}
+}
+
+static void readSummary(SummaryReader &R, ModuleSummary &S) {
+
+	S.SourceFileName = R.str();
+
+	R.NumFuncs = R.count();
+	for (unsigned i = 0; i < R.NumFuncs && R.ok(); ++i) {
+		ModuleSummary::FuncSym Sym;
+		Sym.Name = R.str();
+		Sym.GUID = R.u64();
+		uint8_t Linkage = R.u8();
+		if (Linkage > GlobalValue::CommonLinkage)
+			R.Bad = true;
+		Sym.Linkage = (GlobalValue::LinkageTypes)Linkage;
+		Sym.IsDeclaration = R.u8();
+		Sym.EntryName = R.str();
+		S.Funcs.push_back(std::move(Sym));
+	}
+
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		size_t Hash = R.type();
+		S.AddrTakenFuncs.push_back(std::make_pair(Hash, R.func()));
+	}
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		size_t Hash = R.type();
+		int Idx = R.u32();
+		S.Confinements.push_back(std::make_tuple(Hash, Idx, R.func()));
+	}
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		size_t ToHash = R.type();
+		int ToIdx = R.u32();
+		size_t FromHash = R.type();
+		int FromIdx = R.u32();
+		S.Propagations.push_back(
+				std::make_tuple(ToHash, ToIdx, FromHash, FromIdx));
+	}
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i)
+		S.Escapes.push_back(R.typeIdx());
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i)
+		S.Caps.push_back(R.type());
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i)
+		S.StoredFuncs.push_back(R.func());
+
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		ModuleSummary::ArgSink Sink;
+		Sink.Func = R.func();
+		Sink.ArgNo = R.u8();
+		Sink.Complete = R.u8();
+		for (uint32_t j = 0, n = R.count(); j < n && R.ok(); ++j) {
+			size_t Hash = R.type();
+			Sink.Chain.push_back(std::make_pair(Hash, (int)R.u32()));
+		}
+		S.ArgSinks.push_back(std::move(Sink));
+	}
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		ModuleSummary::CallArg CA;
+		CA.Func = R.func();
+		CA.FuncHash = R.type();
+		CA.CalleeGUID = R.u64();
+		CA.ArgNo = R.u8();
+		S.CallArgs.push_back(CA);
+	}
+
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		std::string Elements = R.str();
+		S.StructNames.push_back(std::make_pair(Elements, R.str()));
+	}
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		S.StructNameDeps.emplace_back(R.str(), std::vector<std::string>());
+		auto &Names = S.StructNameDeps.back().second;
+		for (uint32_t j = 0, n = R.count(); j < n && R.ok(); ++j)
+			Names.push_back(R.str());
+	}
+}
+
+static void writeState(SummaryWriter &W, const ResolutionState &State) {
+
+	W.str(State.Config);
+
+	W.u32(State.Funcs.size());
+	for (auto &F : State.Funcs) {
+		W.u32(F.first);
+		W.str(F.second);
+	}
+
+	W.u32(State.Modules.size());
+	for (auto &MS : State.Modules) {
+		W.str(MS.File);
+		W.str(MS.Key);
+		W.u32(MS.CallSites.size());
+		for (auto &CS : MS.CallSites) {
+			W.u32(CS.Caller);
+			W.u8(CS.Indirect);
+			W.u8(CS.Layer);
+			W.u32(CS.Deps.size());
+			for (auto &D : CS.Deps) {
+				W.type(D.first);
+				W.u32(D.second);
+			}
+			W.u32(CS.Targets.size());
+			for (auto T : CS.Targets)
+				W.u32(T);
+		}
+	}
+}
+
+static void readState(SummaryReader &R, ResolutionState &State) {
+
+	State.Config = R.str();
+
+	R.NumFuncs = R.count();
+	for (unsigned i = 0; i < R.NumFuncs && R.ok(); ++i) {
+		unsigned File = R.u32();
+		State.Funcs.push_back(std::make_pair(File, R.str()));
+	}
+
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i) {
+		State.Modules.emplace_back();
+		auto &MS = State.Modules.back();
+		MS.File = R.str();
+		MS.Key = R.str();
+		for (uint32_t j = 0, n = R.count(); j < n && R.ok(); ++j) {
+			ResolutionState::CallSite CS;
+			CS.Caller = R.func();
+			CS.Indirect = R.u8();
+			CS.Layer = R.u8();
+			for (uint32_t k = 0, m = R.count(); k < m && R.ok(); ++k) {
+				size_t Hash = R.type();
+				CS.Deps.push_back(std::make_pair(Hash, (int)R.u32()));
+			}
+			for (uint32_t k = 0, m = R.count(); k < m && R.ok(); ++k)
+				CS.Targets.push_back(R.func());
+			MS.CallSites.push_back(std::move(CS));
+		}
+	}
+}
+
+// A file of the cache: the magic, the table of types, and the body
+static bool readCacheFile(StringRef Path, const char (&Magic)[8],
+		function_ref<void(SummaryReader &)> ReadBody) {
+
+	auto Buf = MemoryBuffer::getFile(Path);
+	if (!Buf)
+		return false;
+
+	StringRef Data = (*Buf)->getBuffer();
+	if (!Data.startswith(StringRef(Magic, sizeof(Magic))))
+		return false;
+
+	SummaryReader R(Data);
+	R.DE.skip(R.C, sizeof(Magic));
+	for (uint32_t i = 0, e = R.count(); i < e && R.ok(); ++i)
+		R.Types.push_back(internTypeString(R.str()));
+	ReadBody(R);
+
+	return R.ok() && R.DE.eof(R.C);
+}
+
+static void writeCacheFile(StringRef Path, const char (&Magic)[8],
+		function_ref<void(SummaryWriter &)> WriteBody) {
+
+	std::string Body;
+	raw_string_ostream BodyOS(Body);
+	SummaryWriter BW(BodyOS);
+	WriteBody(BW);
+	BodyOS.flush();
+
+	SmallString<128> TmpPath;
+	int FD;
+	if (sys::fs::createUniqueFile(Path + ".%%%%%%.tmp", FD, TmpPath))
+		return;
+
+	bool Failed;
+	{
+		raw_fd_ostream OS(FD, /*shouldClose=*/true);
+		SummaryWriter W(OS);
+		OS.write(Magic, sizeof(Magic));
+		W.u32(BW.Types.size());
+		for (auto ID : BW.Types)
+			W.str(getTypeString(ID));
+		OS << Body;
+		OS.close();
+		Failed = OS.has_error();
+		OS.clear_error();
+	}
+	if (Failed || sys::fs::rename(TmpPath, Path))
+		sys::fs::remove(TmpPath);
+}
+
+SummaryCache::SummaryCache(StringRef Dir_) : Dir(Dir_.str()) {
+	sys::fs::create_directories(Dir);
+}
+
+std::string SummaryCache::getPath(StringRef Key) {
+
+	SmallString<128> Path(Dir);
+	sys::path::append(Path, Key + ".sum");
+	return Path.str().str();
+}
+
+std::string SummaryCache::getKey(StringRef File) {
+
+	auto Buf = MemoryBuffer::getFile(File);
+	if (!Buf)
+		return "";
+
+	// Summaries also depend on the version and the configuration
+	MD5 Hash;
+	Hash.update(StringRef(SummaryMagic, sizeof(SummaryMagic)));
+	Hash.update(std::to_string(SummaryVersion));
+	Hash.update(std::to_string(LAYER_WALK_BUDGET));
+	Hash.update((*Buf)->getBuffer());
+	MD5::MD5Result Result;
+	Hash.final(Result);
+	return Result.digest().str().str();
+}
+
+bool SummaryCache::load(StringRef Key, ModuleSummary &S) {
+
+	if (readCacheFile(getPath(Key), SummaryMagic,
+				[&](SummaryReader &R) { readSummary(R, S); }))
+		return true;
+	S = ModuleSummary();
+	return false;
+}
+
+void SummaryCache::store(StringRef Key, const ModuleSummary &S) {
+	writeCacheFile(getPath(Key), SummaryMagic,
+			[&](SummaryWriter &W) { writeSummary(W, S); });
+}
+
+bool SummaryCache::loadState(ResolutionState &State) {
+
+	SmallString<128> Path(Dir);
+	sys::path::append(Path, "resolution.state");
+	if (readCacheFile(Path, StateMagic,
+				[&](SummaryReader &R) { readState(R, State); }))
+		return true;
+	State = ResolutionState();
+	return false;
+}
+
+void SummaryCache::storeState(const ResolutionState &State) {
+
+	SmallString<128> Path(Dir);
+	sys::path::append(Path, "resolution.state");
+	writeCacheFile(Path, StateMagic,
+			[&](SummaryWriter &W) { writeState(W, State); });
+}
+
+bool SummaryCache::isUpToDate(const ModuleSummary &S) {
+
+	for (auto &D : S.StructNameDeps) {
+		std::vector<std::string> Names;
+		getElementsStructNames(D.first, Names);
+		if (Names != D.second)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,129 @@
+#ifndef _MODULE_SUMMARY_H
+#define _MODULE_SUMMARY_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/GlobalValue.h>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+//
+// The contributions of a module to the type tables of MLTA. A summary
+// does not refer to the IR, so it outlives its module: functions are
+// referred to by their index in Funcs, and types by their hashes.
+//
+struct ModuleSummary {
+
+	// A function defined or declared in the module
+	struct FuncSym {
+		std::string Name;
+		uint64_t GUID;
+		llvm::GlobalValue::LinkageTypes Linkage;
+		bool IsDeclaration;
+		// Name of the entry block of a definition
+		std::string EntryName;
+	};
+
+	// A store or cast of an argument of a defined function. A function
+	// passed as the argument is confined by the base-type chain of it.
+	struct ArgSink {
+		unsigned Func;
+		int8_t ArgNo;
+		std::vector<std::pair<size_t, int>> Chain;
+		bool Complete;
+	};
+
+	// A function passed to a declared function. It is confined by the
+	// sinks of the definition, which is in another module.
+	struct CallArg {
+		unsigned Func;
+		// Hash of the type of the passed function
+		size_t FuncHash;
+		uint64_t CalleeGUID;
+		int8_t ArgNo;
+	};
+
+	std::string SourceFileName;
+	std::vector<FuncSym> Funcs;
+
+	// Address-taken functions with their signature hashes
+	std::vector<std::pair<size_t, unsigned>> AddrTakenFuncs;
+	// Entries of typeIdxFuncsMap: (type, idx, function)
+	std::vector<std::tuple<size_t, int, unsigned>> Confinements;
+	// Entries of typeIdxPropMap: (to type, to idx, from type, from idx)
+	std::vector<std::tuple<size_t, int, size_t, int>> Propagations;
+	std::vector<size_t> Escapes;
+	std::vector<size_t> Caps;
+	std::vector<unsigned> StoredFuncs;
+
+	std::vector<ArgSink> ArgSinks;
+	std::vector<CallArg> CallArgs;
+
+	// Structs of the module as (elements, name), from which the names
+	// of literal structs are taken
+	std::vector<std::pair<std::string, std::string>> StructNames;
+	// Names of the literal structs the type hashes above depend on, as
+	// (elements, names). All modules contribute to them.
+	std::vector<std::pair<std::string, std::vector<std::string>>>
+		StructNameDeps;
+};
+
+//
+// The call sites resolved by a run over a list of files, from which the
+// next run resolves only the ones whose dependencies change. Types are
+// referred to by their hashes.
+//
+struct ResolutionState {
+
+	struct CallSite {
+		unsigned Caller;
+		bool Indirect;
+		// As MLTA::CallDeps, for indirect calls
+		char Layer;
+		std::vector<std::pair<size_t, int>> Deps;
+		std::vector<unsigned> Targets;
+	};
+
+	struct ModuleState {
+		std::string File;
+		std::string Key;
+		// In the order the call sites are resolved in
+		std::vector<CallSite> CallSites;
+	};
+
+	// What the results depend on besides the files
+	std::string Config;
+	// Functions as (index of the file, name)
+	std::vector<std::pair<unsigned, std::string>> Funcs;
+	std::vector<ModuleState> Modules;
+};
+
+//
+// On-disk cache of summaries, keyed by the content of bitcode files.
+// Entries are written once and replaced atomically, so a directory can
+// be shared by concurrent runs.
+//
+class SummaryCache {
+
+	std::string Dir;
+	std::string getPath(llvm::StringRef Key);
+
+public:
+
+	SummaryCache(llvm::StringRef Dir);
+
+	// Key of the content of a bitcode file; empty if it cannot be read
+	static std::string getKey(llvm::StringRef File);
+	bool load(llvm::StringRef Key, ModuleSummary &S);
+	void store(llvm::StringRef Key, const ModuleSummary &S);
+
+	// Whether the names of literal structs S depends on are unchanged
+	static bool isUpToDate(const ModuleSummary &S);
+
+	// The state of the last run with the cache
+	bool loadState(ResolutionState &State);
+	void storeState(const ResolutionState &State);
+};
+
+#endif
@@ -0,0 +1,124 @@
+//===-- Timing.cc - Phase timers and time traces ----------------===//
+//
+// Time traces are recorded by the time-trace profiler of LLVM, which
+// keeps an instance per thread and merges them when written.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/TimeProfiler.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "Timing.h"
+
+using namespace llvm;
+
+typedef std::chrono::steady_clock Clock;
+
+static bool Tracing = false;
+static unsigned TraceGranularity;
+
+struct PhaseStats {
+	uint64_t Count = 0;
+	Clock::duration Total = Clock::duration::zero();
+	Clock::duration Max = Clock::duration::zero();
+};
+
+static bool Summarizing = false;
+static Clock::time_point SummaryStart;
+static std::mutex SummaryLock;
+static StringMap<PhaseStats> Summary;
+
+PhaseTimer::PhaseTimer(StringRef Name_, StringRef Detail)
+	: Name(Name_), Summarized(Summarizing),
+	Traced(timeTraceProfilerEnabled()) {
+
+	if (Summarized)
+		Start = Clock::now();
+	if (Traced)
+		timeTraceProfilerBegin(Name, Detail);
+}
+
+PhaseTimer::~PhaseTimer() {
+
+	if (Traced)
+		timeTraceProfilerEnd();
+	if (!Summarized)
+		return;
+
+	Clock::duration D = Clock::now() - Start;
+	std::lock_guard<std::mutex> Guard(SummaryLock);
+	PhaseStats &S = Summary[Name];
+	++S.Count;
+	S.Total += D;
+	S.Max = std::max(S.Max, D);
+}
+
+TraceThread::TraceThread() : Active(Tracing) {
+	if (Active)
+		timeTraceProfilerInitialize(TraceGranularity, "kanalyzer");
+}
+
+TraceThread::~TraceThread() {
+	if (Active)
+		timeTraceProfilerFinishThread();
+}
+
+void startTimeTrace(unsigned Granularity) {
+	Tracing = true;
+	TraceGranularity = Granularity;
+	timeTraceProfilerInitialize(Granularity, "kanalyzer");
+}
+
+bool writeTimeTrace(StringRef Path, std::string &Error) {
+
+	std::error_code EC;
+	raw_fd_ostream Out(Path, EC, sys::fs::OF_Text);
+	if (EC) {
+		Error = EC.message();
+		return false;
+	}
+	timeTraceProfilerWrite(Out);
+	timeTraceProfilerCleanup();
+	Tracing = false;
+	return true;
+}
+
+void startTimeSummary() {
+	Summarizing = true;
+	SummaryStart = Clock::now();
+}
+
+void printTimeSummary(raw_ostream &OS) {
+
+	auto Seconds = [](Clock::duration D) {
+		return std::chrono::duration<double>(D).count();
+	};
+
+	std::lock_guard<std::mutex> Guard(SummaryLock);
+	std::vector<StringMapEntry<PhaseStats> *> Phases;
+	for (auto &P : Summary)
+		Phases.push_back(&P);
+	std::sort(Phases.begin(), Phases.end(), [](StringMapEntry<PhaseStats> *A,
+				StringMapEntry<PhaseStats> *B) {
+		return A->second.Total > B->second.Total;
+	});
+
+	// Phases nest, and the times of a phase run by several threads
+	// add up, so the totals may exceed the wall time
+	OS << "############## Time Summary ##############\n";
+	OS << left_justify("Phase", 32) << right_justify("Calls", 11)
+		<< right_justify("Total (s)", 13) << right_justify("Max (s)", 13) << "\n";
+	for (auto P : Phases) {
+		OS << format("%-32s %10llu %12.3f %12.3f\n", P->getKey().str().c_str(),
+				(unsigned long long)P->second.Count, Seconds(P->second.Total),
+				Seconds(P->second.Max));
+	}
+	OS << left_justify("Wall time", 43)
+		<< format(" %12.3f\n", Seconds(Clock::now() - SummaryStart));
+}
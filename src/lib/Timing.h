@@ -0,0 +1,45 @@
+#ifndef _KA_TIMING_H
+#define _KA_TIMING_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <string>
+
+//
+// Timers of the phases of a run. A PhaseTimer times its scope, which
+// is added to the total of its phase in the summary and, while the time
+// trace is on, is an event of the trace, with a detail such as the
+// module. Both are off by default, which leaves a timer a check.
+//
+class PhaseTimer {
+	// Literals mostly; it must outlive the timer
+	llvm::StringRef Name;
+	std::chrono::steady_clock::time_point Start;
+	bool Summarized, Traced;
+public:
+	PhaseTimer(llvm::StringRef Name_, llvm::StringRef Detail = "");
+	~PhaseTimer();
+};
+
+// A worker thread records its time trace in the scope of one
+class TraceThread {
+	bool Active;
+public:
+	TraceThread();
+	~TraceThread();
+};
+
+// Record the time trace of the calling thread and of the worker
+// threads, in events of at least Granularity microseconds
+void startTimeTrace(unsigned Granularity);
+// Write the time trace in the Chrome trace-event format, which
+// chrome://tracing and Perfetto open
+bool writeTimeTrace(llvm::StringRef Path, std::string &Error);
+
+void startTimeSummary();
+// The total time of each phase, the heaviest first
+void printTimeSummary(llvm::raw_ostream &OS);
+
+#endif